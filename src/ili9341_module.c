@@ -19,6 +19,8 @@
 #include <structmember.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -28,6 +30,7 @@
 #include "ili9341.h"
 #include "fonts.h"
 #include "nanojpeg.h"
+#include "pixops.h"
 
 #define SYSFS_GPIO_DIR "/sys/class/gpio"
 
@@ -35,6 +38,143 @@
 #define OUTPUT	1
 
 #define SPIDEV_MAXPATH	128
+#define SPI_TX_BUFSIZE	4096	/* spidev default bufsiz */
+
+/*
+ * Compressed images come from a Python string or are read from file in
+ * small chunks, neither is expanded to a full RGB565 image in memory.
+ */
+typedef struct {
+	int fd;		/* -1 when reading from memory */
+	unsigned char *p, *end;
+	unsigned char buf[1024];
+} tft_stream;
+
+/*
+ * RLE image: "R565", big-endian 16-bit width and height, then packets
+ * running through rows left to right, top to bottom. Control byte with
+ * top bit set repeats the next RGB565 pixel (c & 0x7f) + 1 times, otherwise
+ * c + 1 literal RGB565 pixels follow.
+ */
+#define RLE_MAGIC	"R565"
+
+/*
+ * LZ4 image: "L565", big-endian 16-bit width, height and rows per block,
+ * then for each block big-endian 32-bit size and LZ4 block data that
+ * decompresses to those rows of RGB565 pixels. Blocks are independent.
+ */
+#define LZ4_MAGIC	"L565"
+#define LZ4_MAX_BLOCK	65536
+
+/*
+ * Font file: "FNT1", 16-bit height, 16-bit number of ranges and 32-bit
+ * number of glyphs. Then ranges of 32-bit first code point, count and
+ * index of its first glyph sorted by code point, 32-bit file offset of
+ * each glyph's column data, 8-bit width of each glyph and the column data
+ * laid out as in FontCreator arrays. Numbers are little-endian like the
+ * Raspberry Pi, so the mapped tables are used in place.
+ */
+#define FONT_MAGIC	"FNT1"
+#define FONT_HEADER	12
+
+typedef struct {
+	unsigned int first, count, index;
+} tft_range;
+
+/*
+ * Font descriptor, built once per font from its FontCreator array when the
+ * font is first used, or pointing into a mapped font file. Holds metrics
+ * and the data offset of every glyph so text drawing never walks the
+ * width table.
+ */
+typedef struct {
+	const unsigned char *data;
+	int height;		/* pixels */
+	int bytes;		/* bytes per glyph column */
+	int ranges;
+	const tft_range *range;		/* sorted by first code point */
+	int space;		/* width of ' ', fonts often lack it so 'n' is used */
+	const unsigned char *width;	/* per glyph */
+	const unsigned int *offset;	/* per glyph, column data in data */
+	size_t size;		/* of mapped file, 0 for built-in fonts */
+} tft_font;
+
+/*
+ * Font registry, names hashed to buckets. Built-in fonts are registered on
+ * first lookup and get their descriptor on first use, font files are
+ * mapped by load_font(). Fonts are never freed, caches and scenes keep
+ * pointers to them.
+ */
+#define FONT_BUCKETS	64
+
+typedef struct tft_font_entry {
+	struct tft_font_entry *next;
+	const char *name;
+	const unsigned char *builtin;	/* FontCreator array, NULL for files */
+	tft_font *font;
+} tft_font_entry;
+
+/*
+ * Char of decoded UTF-8 text, its glyph looked up once per string in the
+ * current font or the first fallback font that has it.
+ */
+typedef struct {
+	int ch;			/* code point */
+	int pos;		/* byte offset in string */
+	tft_font *font;		/* font glyph comes from */
+	const unsigned char *glyph;	/* NULL for space and missing glyphs */
+	int width;
+} tft_char;
+
+#define FONT_FALLBACKS	4
+
+/*
+ * LRU cache of pixel blocks rendered for a key, charged against a byte
+ * budget. Holds glyphs and whole text lines expanded to RGB565.
+ */
+typedef struct tft_cache_entry {
+	struct tft_cache_entry *prev, *next;	/* LRU list, most recent first */
+	struct tft_cache_entry *hnext;
+	unsigned int hash;
+	int size;		/* bytes charged to budget */
+	int key_len;
+	unsigned char *key;
+	unsigned char *px;	/* big-endian RGB565, row by row */
+} tft_cache_entry;
+
+#define TFT_CACHE_BUCKETS	64
+
+typedef struct {
+	tft_cache_entry *hash[TFT_CACHE_BUCKETS];
+	tft_cache_entry *head, *tail;
+	int bytes, budget;
+} tft_cache;
+
+#define GLYPH_CACHE_BUDGET	16384
+#define TEXT_CACHE_BUDGET	65536
+
+// raster ops combining drawn color with what is already there
+#define TFT_ROP_COPY	0
+#define TFT_ROP_XOR	1
+#define TFT_ROP_AND	2
+#define TFT_ROP_OR	3
+
+// text block layout, lines are measured and placed before drawing
+#define TFT_ALIGN_LEFT		0
+#define TFT_ALIGN_CENTER	1
+#define TFT_ALIGN_RIGHT		2
+
+#define TFT_WRAP_NONE	0
+#define TFT_WRAP_CHAR	1
+#define TFT_WRAP_WORD	2
+
+// largest radius of circular shapes, keeps squared distances in 64 bits
+#define TFT_MAX_RADIUS	(1 << 24)
+
+typedef struct {
+	int start, len;		/* chars of laid out string */
+	int x, y, width;	/* relative to block origin */
+} tft_line;
 
 typedef struct {
 	PyObject_HEAD
@@ -48,10 +188,36 @@ typedef struct {
 	int height;
 	int rotation;
 
-	unsigned char *font;
+	tft_font *font;
+	tft_font *fallback[FONT_FALLBACKS];	/* tried in order for glyphs font lacks */
+	int fallbacks;
 	int color, bg_color, char_spacing;
 	int cursor_x;
 	int cursor_y;
+
+	int clip_x0, clip_y0, clip_x1, clip_y1;	/* drawing clip, inclusive */
+	int madctl;		/* memory access control of current rotation */
+	int madctl_cur;	/* value last sent, differs while drawing rotated text */
+	int dither;		/* PX_DITHER_* used for true color images */
+	int rop;		/* TFT_ROP_* applied by drawing primitives */
+
+	tft_cache glyph_cache;	/* glyphs in given colors */
+	tft_cache text_cache;	/* whole strings drawn with cache=1 */
+
+	// indexed framebuffer, NULL when drawing goes straight to the panel
+	unsigned char *fb;
+	int fb_bpp, fb_stride;
+	int win_x0, win_x1, win_y1, win_x, win_y;	/* window written in fb or with rop */
+	short *fb_dirty;		/* dirty x0, x1 for each row, x0 > x1 if clean */
+	int pal_changed;
+	unsigned char pal_dirty[256];
+	unsigned short palette[256];
+	unsigned char fb_lut[256 * 16];	/* fb byte to big-endian RGB565 pixels */
+	int inv_valid;
+	unsigned char inv_lut[4096];	/* RGB444 to nearest palette index */
+
+	int tx_len;
+	unsigned char tx_buf[SPI_TX_BUFSIZE];
 } ILI9341PyObject;
 
 static PyMemberDef ili9341_members[] = {
@@ -81,10 +247,66 @@ static void TFT_sendWord(ILI9341PyObject *self, int data);
 static void TFT_setCol(ILI9341PyObject *self, int StartCol, int EndCol);
 static void TFT_setPage(ILI9341PyObject *self, int StartPage, int EndPage);
 static void TFT_setXY(ILI9341PyObject *self, int poX, int poY);
+static void TFT_setWindow(ILI9341PyObject *self, int x0, int y0, int x1, int y1);
+static void TFT_sendBuffer(ILI9341PyObject *self, unsigned char *buf, int len);
+static void TFT_panelWindow(ILI9341PyObject *self, int x0, int y0, int x1, int y1);
+static void TFT_panelSend(ILI9341PyObject *self, unsigned char *buf, int len);
+static inline int TFT_fbGet(ILI9341PyObject *self, int x, int y);
+static inline void TFT_fbSet(ILI9341PyObject *self, int x, int y, int index);
+static int TFT_fbIndex(ILI9341PyObject *self, int color);
+static int TFT_fbAlloc(ILI9341PyObject *self, int bpp);
+static void TFT_fbFree(ILI9341PyObject *self);
+static void TFT_fbDirty(ILI9341PyObject *self, int x0, int y0, int x1, int y1);
+static void TFT_fbLut(ILI9341PyObject *self);
+static void TFT_defaultPalette(ILI9341PyObject *self);
+static void TFT_fbFlush(ILI9341PyObject *self);
+static void TFT_pushBytes(ILI9341PyObject *self, unsigned char *data, int len);
+static void TFT_flush(ILI9341PyObject *self);
+static void TFT_resetClip(ILI9341PyObject *self);
+static int TFT_clipRect(ILI9341PyObject *self, int *x, int *y, int *w, int *h);
+static long long TFT_areaSize(int w, int h, int bpp);
+static int TFT_clamp(long long v, int lo, int hi);
+static void TFT_fillRect(ILI9341PyObject *self, int x, int y, int w, int h, int color);
+static void TFT_setMadctl(ILI9341PyObject *self, int madctl);
+static int TFT_charDir(ILI9341PyObject *self, const tft_char *c, int direction, int transparent);
+static void TFT_fillWindow(ILI9341PyObject *self, int x, int y, int w, int h, int color);
+static void TFT_gradientRect(ILI9341PyObject *self, int x, int y, int w, int h, int c0, int c1, int vertical);
+static void TFT_gradientCircle(ILI9341PyObject *self, int x0, int y0, int r, int c0, int c1);
+static void TFT_thickLine(ILI9341PyObject *self, int x0, int y0, int x1, int y1, int width, int color);
+static void TFT_roundRect(ILI9341PyObject *self, int x, int y, int w, int h, int r, int color, int fill);
+static void TFT_arc(ILI9341PyObject *self, int x0, int y0, int r, int start, int end, int thickness, int color);
+static int TFT_streamOpen(tft_stream *st, unsigned char *data, int len, const char *magic);
+static void TFT_streamClose(tft_stream *st);
+static int TFT_rleImage(ILI9341PyObject *self, tft_stream *st, int x, int y);
+static int TFT_lz4Image(ILI9341PyObject *self, tft_stream *st, int x, int y);
+static void TFT_bitmap(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data, int lsb, int fg, int bg);
+static void TFT_blit(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data);
+static void TFT_blitFormat(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data, int format);
+static int TFT_pixelFormat(const char *name);
+static int TFT_ditherMode(const char *name);
+static void TFT_readRect(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data);
+static inline int TFT_rop(int rop, int dst, int src);
+static int TFT_floodFill(ILI9341PyObject *self, int x, int y, int color);
+static void TFT_line(ILI9341PyObject *self, int x0, int y0, int x1, int y1, int color);
+static void TFT_rect(ILI9341PyObject *self, int x, int y, int w, int h, int color);
+static tft_font *TFT_findFont(const char *name);
+static tft_font *TFT_fontMap(const char *path);
+static tft_font_entry *TFT_fontEntry(const char *name);
+static int TFT_fontRegister(const char *name, tft_font *font);
+static void TFT_fontSpace(tft_font *f);
 static int TFT_rgb2color(ILI9341PyObject *self, int R, int G, int B);
 static void TFT_setPixel(ILI9341PyObject *self, int poX, int poY, int color);
 static int TFT_char(ILI9341PyObject *self, unsigned char ch);
-static int TFT_charWidth(ILI9341PyObject *self, unsigned char ch);
+static void TFT_cacheTrim(tft_cache *c, int budget);
+static unsigned int TFT_cacheHash(const unsigned char *key, int len);
+static int TFT_text(ILI9341PyObject *self, const tft_char *str, int n, int x, int y, int spacing, int cache);
+static int TFT_textRuns(ILI9341PyObject *self, const tft_char *str, int n, int x, int y, int spacing);
+static void TFT_glyphRuns(ILI9341PyObject *self, tft_font *font, const unsigned char *glyph, int w, int x, int y, int ax, int ay, int dx, int dy);
+static void TFT_charGlyph(ILI9341PyObject *self, int ch, tft_char *c);
+static int TFT_decode(ILI9341PyObject *self, const unsigned char *str, int len, tft_char *out);
+static int TFT_textWidth(const tft_char *str, int n, int spacing);
+static inline int TFT_fontRows(tft_font *f);
+static int TFT_layout(ILI9341PyObject *self, const tft_char *str, int n, int w, int h, int align, int wrap, tft_line *lines);
 
 static void swap(int *a, int *b);
 
@@ -133,9 +355,24 @@ ili9341_init(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
 	self->cursor_x = 0;
 	self->cursor_y = 0;
 
-	self->font = System5x7;
+	if ((self->font = TFT_findFont("System5x7")) == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	self->fallbacks = 0;
 	self->char_spacing = 1;
 
+	self->tx_len = 0;
+	self->dither = PX_DITHER_NONE;
+	self->rop = TFT_ROP_COPY;
+	TFT_cacheTrim(&self->glyph_cache, 0);
+	TFT_cacheTrim(&self->text_cache, 0);
+	self->glyph_cache.budget = GLYPH_CACHE_BUDGET;
+	self->text_cache.budget = TEXT_CACHE_BUDGET;
+	TFT_fbFree(self);
+	TFT_defaultPalette(self);
+	TFT_resetClip(self);
+
 	TFT_DC_HIGH;
 
 	TFT_RST_LOW;
@@ -192,6 +429,7 @@ ili9341_init(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
 
 	TFT_sendCMD(self, ILI9341_MADCTL);    	// Memory Access Control
 	TFT_sendDATA(self, MADCTL_MX | MADCTL_BGR);
+	self->madctl = self->madctl_cur = MADCTL_MX | MADCTL_BGR;
 
 	TFT_sendCMD(self, ILI9341_PIXFMT);
 	TFT_sendDATA(self, 0x55);
@@ -261,6 +499,12 @@ ili9341_clear(ILI9341PyObject *self, PyObject *unused) {
     struct spi_ioc_transfer xfer;
 	int i, bytes = (ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT);
 
+	if (self->fb != NULL) {
+		memset(self->fb, 0, self->fb_stride * self->height);
+		TFT_fbDirty(self, 0, 0, self->width - 1, self->height - 1);
+		Py_RETURN_NONE;
+	}
+
 	TFT_setCol(self, 0, self->width);
 	TFT_setPage(self, 0, self->height);
 	TFT_sendCMD(self, 0x2c);	// start to write to display ram
@@ -284,31 +528,38 @@ ili9341_rotation(ILI9341PyObject *self, PyObject *args) {
 
 	self->rotation = mode % 4;
 
-	TFT_sendCMD(self, ILI9341_MADCTL);
-
 	switch (self->rotation) {
 		case 0:
-			TFT_sendCMD(self, MADCTL_MX | MADCTL_BGR);
+			self->madctl = MADCTL_MX | MADCTL_BGR;
 			self->width  = ILI9341_TFTWIDTH;
 			self->height = ILI9341_TFTHEIGHT;
 			break;
 		case 1:
-			TFT_sendCMD(self, MADCTL_MV | MADCTL_BGR);
+			self->madctl = MADCTL_MV | MADCTL_BGR;
 			self->width  = ILI9341_TFTHEIGHT;
 			self->height = ILI9341_TFTWIDTH;
 			break;
 		case 2:
-			TFT_sendCMD(self, MADCTL_MY | MADCTL_BGR);
+			self->madctl = MADCTL_MY | MADCTL_BGR;
 			self->width  = ILI9341_TFTWIDTH;
 			self->height = ILI9341_TFTHEIGHT;
 			break;
 		case 3:
-			TFT_sendCMD(self, MADCTL_MX | MADCTL_MY | MADCTL_MV | MADCTL_BGR);
+			self->madctl = MADCTL_MX | MADCTL_MY | MADCTL_MV | MADCTL_BGR;
 			self->width  = ILI9341_TFTHEIGHT;
 			self->height = ILI9341_TFTWIDTH;
 			break;
 	}
 
+	self->madctl_cur = -1;
+	TFT_setMadctl(self, self->madctl);
+
+	TFT_resetClip(self);
+
+	if (self->fb != NULL && TFT_fbAlloc(self, self->fb_bpp) < 0) {
+		return PyErr_NoMemory();
+	}
+
 	Py_RETURN_NONE;
 }
 
@@ -353,67 +604,99 @@ ili9341_drawPixel(ILI9341PyObject *self, PyObject *args) {
 	Py_RETURN_NONE;
 }
 
-// Bresenham's algorithm - thx wikpedia
 static PyObject *
-ili9341_drawLine(ILI9341PyObject *self, PyObject *args) {
-	int x0, y0, x1, y1, color;
-	
-	if (!PyArg_ParseTuple(args, "iiiii", &x0, &y0, &x1, &y1, &color)) {
+ili9341_drawLine(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x0, y0, x1, y1, color, width = 1;
+	static char *kwlist[] = {"x0", "y0", "x1", "y1", "color", "width", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iiiii|i", kwlist, &x0, &y0, &x1, &y1, &color, &width)) {
 		return NULL;
 	}
-	
-	int16_t steep = abs(y1 - y0) > abs(x1 - x0);
 
-	if (steep) {
-		swap(&x0, &y0);
-		swap(&x1, &y1);
+	TFT_thickLine(self, x0, y0, x1, y1, width, color);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_roundRect(ILI9341PyObject *self, PyObject *args) {
+	int x, y, w, h, r, color;
+
+	if (!PyArg_ParseTuple(args, "iiiiii", &x, &y, &w, &h, &r, &color)) {
+		return NULL;
 	}
 
-	if (x0 > x1) {
-		swap(&x0, &x1);
-		swap(&y0, &y1);
+	TFT_roundRect(self, x, y, w, h, r, color, 0);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_fillRoundRect(ILI9341PyObject *self, PyObject *args) {
+	int x, y, w, h, r, color;
+
+	if (!PyArg_ParseTuple(args, "iiiiii", &x, &y, &w, &h, &r, &color)) {
+		return NULL;
 	}
 
-	int16_t dx, dy;
-	dx = x1 - x0;
-	dy = abs(y1 - y0);
+	TFT_roundRect(self, x, y, w, h, r, color, 1);
+
+	Py_RETURN_NONE;
+}
 
-	int16_t err = dx / 2;
-	int16_t ystep;
+static PyObject *
+ili9341_arc(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x, y, r, start, end, thickness = 1, color = self->color;
+	PyObject *colorObj = Py_None;
+	static char *kwlist[] = {"x", "y", "r", "start", "end", "thickness", "color", NULL};
 
-	if (y0 < y1) {
-		ystep = 1;
-	} else {
-		ystep = -1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iiiii|iO", kwlist, &x, &y, &r, &start, &end, &thickness, &colorObj)) {
+		return NULL;
 	}
 
-	for (; x0<=x1; x0++) {
-		if (steep) {
-			TFT_setPixel(self, y0, x0, color);
-		} else {
-			TFT_setPixel(self, x0, y0, color);
-		}
-		err -= dy;
-		if (err < 0) {
-			y0 += ystep;
-			err += dx;
-		}
+	// None keeps current color
+	if (colorObj != Py_None) {
+		color = PyInt_AsLong(colorObj);
+		if (PyErr_Occurred()) return NULL;
+	}
+
+	if (r > TFT_MAX_RADIUS) {
+		PyErr_Format(PyExc_ValueError, "radius must be at most %d", TFT_MAX_RADIUS);
+		return NULL;
+	}
+
+	TFT_arc(self, x, y, r, start, end, thickness, color);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_fillPie(ILI9341PyObject *self, PyObject *args) {
+	int x, y, r, start, end, color;
+
+	if (!PyArg_ParseTuple(args, "iiiiii", &x, &y, &r, &start, &end, &color)) {
+		return NULL;
+	}
+
+	if (r > TFT_MAX_RADIUS) {
+		PyErr_Format(PyExc_ValueError, "radius must be at most %d", TFT_MAX_RADIUS);
+		return NULL;
 	}
 
+	TFT_arc(self, x, y, r, start, end, r + 1, color);
+
 	Py_RETURN_NONE;
 }
 
 static PyObject *
 ili9341_drawFastVLine(ILI9341PyObject *self, PyObject *args) {
 	int x, y, len, color;
-    PyObject *pArgs;
 	
 	if (!PyArg_ParseTuple(args, "iiii", &x, &y, &len, &color)) {
 		return NULL;
 	}
 
-	pArgs = Py_BuildValue("iiiii", x, y, x, y+len-1, color);
-	ili9341_drawLine(self, pArgs);
+	TFT_fillRect(self, x, y, 1, len, color);
 	
 	Py_RETURN_NONE;
 }
@@ -421,34 +704,27 @@ ili9341_drawFastVLine(ILI9341PyObject *self, PyObject *args) {
 static PyObject *
 ili9341_drawFastHLine(ILI9341PyObject *self, PyObject *args) {
 	int x, y, len, color;
-    PyObject *pArgs;
 	
 	if (!PyArg_ParseTuple(args, "iiii", &x, &y, &len, &color)) {
 		return NULL;
 	}
 
-	pArgs = Py_BuildValue("iiiii", x, y, x+len-1, y, color);
-	ili9341_drawLine(self, pArgs);
+	TFT_fillRect(self, x, y, len, 1, color);
 	
 	Py_RETURN_NONE;
 }
 
 static PyObject *
 ili9341_drawTriangle(ILI9341PyObject *self, PyObject *args) {
-	int i;
 	int x0, y0, x1, y1, x2, y2, color;
-    PyObject *pArgs;
 
 	if (!PyArg_ParseTuple(args, "iiiiiii", &x0, &y0, &x1, &y1, &x2, &y2, &color)) {
 		return NULL;
 	}
 
-	pArgs = Py_BuildValue("iiiii", x0, y0, x1, y1, color);
-	ili9341_drawLine(self, pArgs);
-	pArgs = Py_BuildValue("iiiii", x1, y1, x2, y2, color);
-	ili9341_drawLine(self, pArgs);
-	pArgs = Py_BuildValue("iiiii", x0, y0, x2, y2, color);
-	ili9341_drawLine(self, pArgs);
+	TFT_line(self, x0, y0, x1, y1, color);
+	TFT_line(self, x1, y1, x2, y2, color);
+	TFT_line(self, x0, y0, x2, y2, color);
 
 	Py_RETURN_NONE;
 }
@@ -456,44 +732,26 @@ ili9341_drawTriangle(ILI9341PyObject *self, PyObject *args) {
 
 static PyObject *
 ili9341_drawRect(ILI9341PyObject *self, PyObject *args) {
-	int i;
 	int x, y, w, h, color;
-    PyObject *pArgs;
 
 	if (!PyArg_ParseTuple(args, "iiiii", &x, &y, &w, &h, &color)) {
 		return NULL;
 	}
 
-	pArgs = Py_BuildValue("iiii", x, y, w, color);
-	ili9341_drawFastHLine(self, pArgs);
-
-	pArgs = Py_BuildValue("iiii", x, y+h-1, w, color);
-	ili9341_drawFastHLine(self, pArgs);
-
-	pArgs = Py_BuildValue("iiii", x, y, h, color);
-	ili9341_drawFastVLine(self, pArgs);
-
-	pArgs = Py_BuildValue("iiii", x+w-1, y, h, color);
-	ili9341_drawFastVLine(self, pArgs);
+	TFT_rect(self, x, y, w, h, color);
 	
 	Py_RETURN_NONE;
 }
 
 static PyObject *
 ili9341_fillRect(ILI9341PyObject *self, PyObject *args) {
-	int i;
 	int x, y, w, h, color;
-    PyObject *pArgs;
 
 	if (!PyArg_ParseTuple(args, "iiiii", &x, &y, &w, &h, &color)) {
 		return NULL;
 	}
 
-	// Update in subclasses if desired!
-	for (i=x; i<x+w; i++) {
-		pArgs = Py_BuildValue("iiii", i, y, h, color);
-		ili9341_drawFastVLine(self, pArgs);
-	}
+	TFT_fillRect(self, x, y, w, h, color);
 
 	Py_RETURN_NONE;
 }
@@ -527,10 +785,14 @@ ili9341_drawCircle(ILI9341PyObject *self, PyObject *args) {
 		ddF_x += 2;
 		f += ddF_x;
 
+		// every pixel once, so xor does not punch holes at the diagonals
+		if (x > y) break;
+
 		TFT_setPixel(self, x0 + x, y0 + y, color);
 		TFT_setPixel(self, x0 - x, y0 + y, color);
 		TFT_setPixel(self, x0 + x, y0 - y, color);
 		TFT_setPixel(self, x0 - x, y0 - y, color);
+		if (x == y) break;
 		TFT_setPixel(self, x0 + y, y0 + x, color);
 		TFT_setPixel(self, x0 - y, y0 + x, color);
 		TFT_setPixel(self, x0 + y, y0 - x, color);
@@ -544,20 +806,16 @@ ili9341_drawCircle(ILI9341PyObject *self, PyObject *args) {
 static PyObject *
 ili9341_fillCircle(ILI9341PyObject *self, PyObject *args) {
 	int poX, poY, r, color;
-    PyObject *pArgs;
 
 	if (!PyArg_ParseTuple(args, "iiii", &poX, &poY, &r, &color)) {
 		return NULL;
 	}
 
-    int x = -r, y = 0, err = 2-2*r, e2;
+    int x = -r, y = 0, err = 2-2*r, e2, cx, cy;
 
     do {
-		pArgs = Py_BuildValue("iiii", poX-x, poY-y, 2*y, color);
-		ili9341_drawFastVLine(self, pArgs);
-
-		pArgs = Py_BuildValue("iiii", poX+x, poY-y, 2*y, color);
-		ili9341_drawFastVLine(self, pArgs);
+		cx = x;
+		cy = y;
 
         e2 = err;
         if (e2 <= y) {
@@ -565,6 +823,12 @@ ili9341_fillCircle(ILI9341PyObject *self, PyObject *args) {
             if (-x == y && e2 <= x) e2 = 0;
         }
         if (e2 > x) err += ++x*2+1;
+
+		// column is done once x moves on, draw it only then with its full height
+		if (x != cx) {
+			TFT_fillRect(self, poX-cx, poY-cy, 1, 2*cy, color);
+			if (cx != 0) TFT_fillRect(self, poX+cx, poY-cy, 1, 2*cy, color);
+		}
     } while (x <= 0);
 
 	Py_RETURN_NONE;
@@ -616,9 +880,9 @@ ili9341_setBgColor(ILI9341PyObject *self, PyObject *args) {
 
 static PyObject *
 ili9341_setFont(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
-	int i, spacing = 1;
-	unsigned char *font;
-	font_info *f = fonts_table;
+	int spacing = 1;
+	char *font;
+	tft_font *data;
 	static char *kwlist[] = {"font", "spacing", NULL};
 
 	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|i",  kwlist, &font, &spacing)) {
@@ -627,14 +891,104 @@ ili9341_setFont(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
 	
 	self->char_spacing = spacing;
 
-	while (f->name != NULL) {
-		if (strcmp(f->name, font) == 0) {
-			self->font = f->data;
-			break;
+	if ((data = TFT_findFont(font)) != NULL) {
+		self->font = data;
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_loadFont(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	char *path, *name = NULL, *p, buf[128];
+	tft_font *font;
+	static char *kwlist[] = {"path", "name", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|z", kwlist, &path, &name)) {
+		return NULL;
+	}
+
+	// file name without directory and extension by default
+	if (name == NULL) {
+		p = strrchr(path, '/');
+		snprintf(buf, sizeof(buf), "%s", p != NULL ? p + 1 : path);
+		if ((p = strrchr(buf, '.')) != NULL && p != buf) *p = '\0';
+		name = buf;
+	}
+
+	if (TFT_fontEntry(name) != NULL) {
+		PyErr_Format(PyExc_ValueError, "font %s already exists", name);
+		return NULL;
+	}
+
+	if ((font = TFT_fontMap(path)) == NULL) {
+		return NULL;
+	}
+
+	if (TFT_fontRegister(name, font) < 0) {
+		munmap((void *)font->data, font->size);
+		free(font);
+		return PyErr_NoMemory();
+	}
+
+	return Py_BuildValue("s", name);
+}
+
+static PyObject *
+ili9341_fallback(ILI9341PyObject *self, PyObject *args) {
+	tft_font *fonts[FONT_FALLBACKS];
+	char *name;
+	int i, n = PyTuple_GET_SIZE(args);
+
+	if (n > FONT_FALLBACKS) {
+		PyErr_Format(PyExc_ValueError, "at most %d fallback fonts", FONT_FALLBACKS);
+		return NULL;
+	}
+
+	for (i=0; i<n; i++) {
+		if ((name = PyString_AsString(PyTuple_GET_ITEM(args, i))) == NULL) {
+			return NULL;
 		}
-		f++;
+		if ((fonts[i] = TFT_findFont(name)) == NULL) {
+			PyErr_Format(PyExc_ValueError, "unknown font %s", name);
+			return NULL;
+		}
+	}
+
+	memcpy(self->fallback, fonts, n * sizeof(tft_font *));
+	self->fallbacks = n;
+
+	// cached lines are keyed by code points, glyphs may now come from other fonts
+	TFT_cacheTrim(&self->text_cache, 0);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_glyphCache(ILI9341PyObject *self, PyObject *args) {
+	int budget;
+
+	if (!PyArg_ParseTuple(args, "i", &budget)) {
+		return NULL;
+	}
+
+	self->glyph_cache.budget = budget > 0 ? budget : 0;
+	TFT_cacheTrim(&self->glyph_cache, self->glyph_cache.budget);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_textCache(ILI9341PyObject *self, PyObject *args) {
+	int budget;
+
+	if (!PyArg_ParseTuple(args, "i", &budget)) {
+		return NULL;
 	}
 
+	self->text_cache.budget = budget > 0 ? budget : 0;
+	TFT_cacheTrim(&self->text_cache, self->text_cache.budget);
+
 	Py_RETURN_NONE;
 }
 
@@ -658,15 +1012,59 @@ ili9341_drawChar(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
 	Py_RETURN_NONE;
 }
 
+// str or unicode argument decoded as UTF-8, sets python error on failure
+static
+tft_char *TFT_decodeArg(ILI9341PyObject *self, PyObject *obj, int *n) {
+	PyObject *bytes;
+	tft_char *str;
+	int len;
+
+	if (PyUnicode_Check(obj)) {
+		if ((bytes = PyUnicode_AsUTF8String(obj)) == NULL) return NULL;
+	} else if (PyString_Check(obj)) {
+		Py_INCREF(obj);
+		bytes = obj;
+	} else {
+		PyErr_SetString(PyExc_TypeError, "string expected");
+		return NULL;
+	}
+
+	len = PyString_GET_SIZE(bytes);
+	if ((str = malloc((len + 1) * sizeof(tft_char))) == NULL) {
+		Py_DECREF(bytes);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	*n = TFT_decode(self, (unsigned char *)PyString_AS_STRING(bytes), len, str);
+	str[*n].pos = len;
+	Py_DECREF(bytes);
+
+	return str;
+}
+
 static PyObject *
 ili9341_writeString(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
-	int i, w;
-	unsigned char *str, ch;
+	int i, w, len, start;
+	PyObject *obj;
+	tft_char *str;
 	int x = self->cursor_x, y = self->cursor_y, color = self->color;
-	static char *kwlist[] = {"str", "x", "y", "color", NULL};
-	unsigned char *font = self->font;
+	int direction = 0, cache = 0, transparent = 0;
+	static char *kwlist[] = {"str", "x", "y", "color", "direction", "cache", "transparent", NULL};
+	tft_font *font = self->font;
 	
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iii", kwlist, &str, &x, &y, &color)) {
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|iiiiii", kwlist, &obj, &x, &y, &color, &direction, &cache, &transparent)) {
+		return NULL;
+	}
+
+	direction = (direction % 360 + 360) % 360;
+	if (direction % 90 != 0) {
+		PyErr_SetString(PyExc_ValueError, "direction must be 0, 90, 180 or 270");
+		return NULL;
+	}
+
+	// glyphs are looked up once, through fallback fonts when font lacks them
+	if ((str = TFT_decodeArg(self, obj, &len)) == NULL) {
 		return NULL;
 	}
 	
@@ -674,370 +1072,4892 @@ ili9341_writeString(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
 	self->cursor_y = y;
 	self->color = color;
 
-	for(i=0; i<strlen(str); i++) {
-		ch = str[i];
-		w = TFT_charWidth(self, ch) + self->char_spacing;
-		TFT_char(self, ch);
-		
+	// rotated text runs along direction without wrapping
+	if (direction != 0) {
+		for (i=0; i<len; i++) {
+			w = TFT_charDir(self, &str[i], direction, transparent) + self->char_spacing;
+			self->cursor_x += direction == 180 ? -w : 0;
+			self->cursor_y += direction == 90 ? w : (direction == 270 ? -w : 0);
+		}
+		TFT_setMadctl(self, self->madctl);
+		free(str);
+
+		Py_RETURN_NONE;
+	}
+
+	// glyphs up to the one crossing right edge make a line, sent as one strip
+	for (start=0, x=self->cursor_x, i=0; i<len; ) {
+		w = str[i++].width + self->char_spacing;
+
 		if ((self->cursor_x + w) <= self->width) {
 			self->cursor_x += w;
+			continue;
+		}
+
+		if (transparent) {
+			TFT_textRuns(self, str + start, i - start, x, self->cursor_y, self->char_spacing);
+		} else {
+			TFT_text(self, str + start, i - start, x, self->cursor_y, self->char_spacing, cache);
 		}
-		else if ((self->cursor_y + font[FONT_HEIGHT] + self->char_spacing) <= self->height) {
+		start = i;
+
+		if ((self->cursor_y + font->height + self->char_spacing) <= self->height) {
 			self->cursor_x = 0;
-			self->cursor_y += font[FONT_HEIGHT] + self->char_spacing;
+			self->cursor_y += font->height + self->char_spacing;
 		}
+		x = self->cursor_x;
+	}
+	if (transparent) {
+		TFT_textRuns(self, str + start, i - start, x, self->cursor_y, self->char_spacing);
+	} else {
+		TFT_text(self, str + start, i - start, x, self->cursor_y, self->char_spacing, cache);
 	}
+	free(str);
 
 	Py_RETURN_NONE;
 }
 
+// align and wrap names, in order of TFT_ALIGN_* and TFT_WRAP_*
+static
+int TFT_layoutMode(const char *align, const char *wrap, int *a, int *w) {
+	static const char *aligns[] = {"left", "center", "right", NULL};
+	static const char *wraps[] = {"none", "char", "word", NULL};
+
+	for (*a=0; aligns[*a] != NULL && strcmp(aligns[*a], align) != 0; (*a)++);
+	for (*w=0; wraps[*w] != NULL && strcmp(wraps[*w], wrap) != 0; (*w)++);
+
+	if (aligns[*a] == NULL || wraps[*w] == NULL) {
+		PyErr_SetString(PyExc_ValueError, "align must be left, center or right and wrap none, char or word");
+		return -1;
+	}
+
+	return 0;
+}
+
 static PyObject *
-ili9341_showJpeg(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
-	int x = self->cursor_x, y = self->cursor_y;
-	int fd;
-	unsigned char *filename;
-	long int jpg_size = 0, nRead = 0;
-	unsigned char *jpg;
-	static char *kwlist[] = {"str", "x", "y", NULL};
-	unsigned char *font = self->font;
-	
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|ii", kwlist, &filename, &x, &y)) {
+ili9341_textSize(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int i, n, len, w = 0, h;
+	char *font = NULL;
+	PyObject *obj;
+	tft_font *data = self->font, *current = self->font;
+	tft_char *str;
+	tft_line *lines;
+	static char *kwlist[] = {"str", "font", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|z", kwlist, &obj, &font)) {
 		return NULL;
 	}
 
-	self->cursor_x = x;
-	self->cursor_y = y;
+	if (font != NULL && (data = TFT_findFont(font)) == NULL) {
+		PyErr_Format(PyExc_ValueError, "unknown font %s", font);
+		return NULL;
+	}
 
-	if ((fd = open(filename, O_RDONLY)) < 0) {
-		Py_RETURN_NONE;
+	self->font = data;
+	str = TFT_decodeArg(self, obj, &len);
+	if (str == NULL || (lines = malloc((len + 1) * sizeof(tft_line))) == NULL) {
+		self->font = current;
+		free(str);
+		return str == NULL ? NULL : PyErr_NoMemory();
 	}
-	
-	jpg_size = lseek(fd, 0, SEEK_END);
-	lseek(fd, 0, SEEK_SET);
 
-	jpg = malloc(jpg_size);
-	nRead = read(fd, jpg, jpg_size);
+	// empty string has no lines to measure
+	n = len > 0 ? TFT_layout(self, str, len, 0, INT_MAX, TFT_ALIGN_LEFT, TFT_WRAP_NONE, lines) : 0;
+	self->font = current;
 
-	if (nRead) {
-		njInit();
-		njDecode(jpg, jpg_size);
+	for (i=0; i<n; i++) {
+		if (lines[i].width > w) w = lines[i].width;
+	}
+	h = n > 0 ? lines[n - 1].y + TFT_fontRows(data) : 0;
+	free(lines);
+	free(str);
 
-		unsigned char *prgb = njGetImage();
+	return Py_BuildValue("(ii)", w, h);
+}
 
-		for (y=njGetHeight()-1; y!=-1; y--) {
-			for (x=0; x<njGetWidth(); ++x){
-				unsigned char *d = prgb + (y * njGetWidth() + x) * njGetNComp();
+static PyObject *
+ili9341_layout(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int i, n, len, w, h, a, wr, start, end;
+	char *align = "left", *wrap = "word", *font = NULL;
+	tft_font *data = self->font, *current = self->font;
+	tft_char *str;
+	tft_line *lines;
+	PyObject *obj, *list, *item;
+	static char *kwlist[] = {"str", "w", "h", "align", "wrap", "font", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oii|ssz", kwlist, &obj, &w, &h, &align, &wrap, &font)) {
+		return NULL;
+	}
 
-				TFT_setPixel(self, self->cursor_x + x, self->cursor_y + y, TFT_rgb2color(self, d[0], d[1], d[2]));
-			}
-		}
-		njDone();
+	if (TFT_layoutMode(align, wrap, &a, &wr) < 0) {
+		return NULL;
 	}
-	
-	free(jpg);
 
-	Py_RETURN_NONE;
-}
+	if (font != NULL && (data = TFT_findFont(font)) == NULL) {
+		PyErr_Format(PyExc_ValueError, "unknown font %s", font);
+		return NULL;
+	}
 
+	self->font = data;
+	str = TFT_decodeArg(self, obj, &len);
+	if (str == NULL || (lines = malloc((len + 1) * sizeof(tft_line))) == NULL) {
+		self->font = current;
+		free(str);
+		return str == NULL ? NULL : PyErr_NoMemory();
+	}
 
-static
-int gpioExport(int gpio) {
-	int fd, len, ret = -1;
-	char buf[255];
+	n = TFT_layout(self, str, len, w, h, a, wr, lines);
+	self->font = current;
 
-	fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
-	if (fd) {
+	// offsets index the string passed, chars of unicode and bytes of str
+	for (i=0, list=PyList_New(n); list != NULL && i<n; i++) {
+		start = lines[i].start;
+		end = start + lines[i].len;
+		if (!PyUnicode_Check(obj)) {
+			start = str[start].pos;
+			end = str[end].pos;
+		}
+
+		if ((item = Py_BuildValue("(iiiii)", start, end, lines[i].x, lines[i].y, lines[i].width)) == NULL) {
+			Py_CLEAR(list);
+			break;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+	free(lines);
+	free(str);
+
+	return list;
+}
+
+static PyObject *
+ili9341_writeBox(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int i, n, len, x, y, w, h, a, wr, lx, ly, bottom;
+	int color = self->color, cache = 0, transparent = 0;
+	int clip_x0 = self->clip_x0, clip_y0 = self->clip_y0, clip_x1 = self->clip_x1, clip_y1 = self->clip_y1;
+	int gh = TFT_fontRows(self->font);
+	char *align = "left", *wrap = "word";
+	PyObject *obj;
+	tft_char *str;
+	tft_line *lines;
+	static char *kwlist[] = {"str", "x", "y", "w", "h", "align", "wrap", "color", "cache", "transparent", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oiiii|ssiii", kwlist, &obj, &x, &y, &w, &h, &align, &wrap, &color, &cache, &transparent)) {
+		return NULL;
+	}
+
+	if (TFT_layoutMode(align, wrap, &a, &wr) < 0) {
+		return NULL;
+	}
+
+	str = TFT_decodeArg(self, obj, &len);
+	if (str == NULL || (lines = malloc((len + 1) * sizeof(tft_line))) == NULL) {
+		free(str);
+		return str == NULL ? NULL : PyErr_NoMemory();
+	}
+
+	n = TFT_layout(self, str, len, w, h, a, wr, lines);
+
+	self->color = color;
+
+	// nothing is drawn outside the box
+	if (x > self->clip_x0) self->clip_x0 = x;
+	if (y > self->clip_y0) self->clip_y0 = y;
+	if (x + w - 1 < self->clip_x1) self->clip_x1 = x + w - 1;
+	if (y + h - 1 < self->clip_y1) self->clip_y1 = y + h - 1;
+
+	// no line fits or nothing to write, box is still cleared
+	if (n == 0 && !transparent) {
+		TFT_fillRect(self, x, y, w, h, self->bg_color);
+	}
+
+	for (i=0; i<n; i++) {
+		lx = x + lines[i].x;
+		ly = y + lines[i].y;
+
+		if (transparent) {
+			TFT_textRuns(self, str + lines[i].start, lines[i].len, lx, ly, self->char_spacing);
+			continue;
+		}
+
+		TFT_text(self, str + lines[i].start, lines[i].len, lx, ly, self->char_spacing, cache);
+
+		// rest of the box in background, so shorter text replaces longer
+		bottom = i < n - 1 ? y + lines[i + 1].y : y + h;
+		TFT_fillRect(self, x, ly, lx - x, gh, self->bg_color);
+		TFT_fillRect(self, lx + lines[i].width, ly, x + w - lx - lines[i].width, gh, self->bg_color);
+		TFT_fillRect(self, x, ly + gh, w, bottom - ly - gh, self->bg_color);
+	}
+
+	self->clip_x0 = clip_x0;
+	self->clip_y0 = clip_y0;
+	self->clip_x1 = clip_x1;
+	self->clip_y1 = clip_y1;
+
+	if (n > 0) {
+		self->cursor_x = x + lines[n - 1].x + lines[n - 1].width + self->char_spacing;
+		self->cursor_y = y + lines[n - 1].y;
+	}
+	free(lines);
+	free(str);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_showJpeg(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x = self->cursor_x, y = self->cursor_y;
+	int fd;
+	char *filename;
+	long int jpg_size = 0, nRead = 0;
+	unsigned char *jpg;
+	static char *kwlist[] = {"str", "x", "y", NULL};
+	
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|ii", kwlist, &filename, &x, &y)) {
+		return NULL;
+	}
+
+	self->cursor_x = x;
+	self->cursor_y = y;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		Py_RETURN_NONE;
+	}
+	
+	jpg_size = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_SET);
+
+	jpg = malloc(jpg_size);
+	nRead = read(fd, jpg, jpg_size);
+	close(fd);
+
+	if (nRead) {
+		njInit();
+		if (njDecode(jpg, jpg_size) == NJ_OK) {
+			TFT_blitFormat(self, x, y, njGetWidth(), njGetHeight(), njGetImage(),
+				njGetNComp() == 1 ? PX_GRAY8 : PX_RGB888);
+		}
+		njDone();
+	}
+	
+	free(jpg);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_rleImage(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x = self->cursor_x, y = self->cursor_y, len, ret;
+	unsigned char *data;
+	tft_stream st;
+	static char *kwlist[] = {"src", "x", "y", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#|ii", kwlist, &data, &len, &x, &y)) {
+		return NULL;
+	}
+
+	self->cursor_x = x;
+	self->cursor_y = y;
+
+	if (TFT_streamOpen(&st, data, len, RLE_MAGIC) < 0) {
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)data);
+	}
+
+	ret = TFT_rleImage(self, &st, x, y);
+	TFT_streamClose(&st);
+
+	if (ret < 0) {
+		PyErr_SetString(PyExc_ValueError, "invalid or truncated RLE image");
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_lz4Image(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x = self->cursor_x, y = self->cursor_y, len, ret;
+	unsigned char *data;
+	tft_stream st;
+	static char *kwlist[] = {"src", "x", "y", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#|ii", kwlist, &data, &len, &x, &y)) {
+		return NULL;
+	}
+
+	self->cursor_x = x;
+	self->cursor_y = y;
+
+	if (TFT_streamOpen(&st, data, len, LZ4_MAGIC) < 0) {
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)data);
+	}
+
+	ret = TFT_lz4Image(self, &st, x, y);
+	TFT_streamClose(&st);
+
+	if (ret < 0) {
+		PyErr_SetString(PyExc_ValueError, "invalid or truncated LZ4 image");
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_rgbTo565(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	unsigned char *data, *out;
+	char *format = "rgb", *dither = NULL;
+	int len, n, f, mode = self->dither, width = 0, i;
+	px_dither d;
+	PyObject *result;
+	static char *kwlist[] = {"data", "format", "dither", "width", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#|szi", kwlist, &data, &len, &format, &dither, &width)) {
+		return NULL;
+	}
+
+	if ((f = TFT_pixelFormat(format)) < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown pixel format %s", format);
+		return NULL;
+	}
+
+	if (dither != NULL && (mode = TFT_ditherMode(dither)) < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown dither mode %s", dither);
+		return NULL;
+	}
+
+	if (len % pxFormatSize(f) != 0) {
+		PyErr_SetString(PyExc_ValueError, "data length is not a multiple of pixel size");
+		return NULL;
+	}
+
+	n = len / pxFormatSize(f);
+	if (n == 0) {
+		return PyString_FromString("");
+	}
+
+	if (width <= 0) width = n;
+	if (n % width != 0) {
+		PyErr_SetString(PyExc_ValueError, "data is not made of whole rows");
+		return NULL;
+	}
+
+	if ((result = PyString_FromStringAndSize(NULL, n * 2)) == NULL) {
+		return NULL;
+	}
+	out = (unsigned char *)PyString_AS_STRING(result);
+
+	if (pxDitherInit(&d, mode, width) < 0) {
+		Py_DECREF(result);
+		return PyErr_NoMemory();
+	}
+
+	for (i=0; i<n; i+=width) {
+		pxDitherRow(&d, out + i * 2, data + i * pxFormatSize(f), 0, width, f);
+		pxDitherNextRow(&d);
+	}
+	pxDitherDone(&d);
+
+	return result;
+}
+
+static PyObject *
+ili9341_setDither(ILI9341PyObject *self, PyObject *args) {
+	char *name;
+	int mode;
+
+	if (!PyArg_ParseTuple(args, "s", &name)) {
+		return NULL;
+	}
+
+	if ((mode = TFT_ditherMode(name)) < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown dither mode %s", name);
+		return NULL;
+	}
+
+	self->dither = mode;
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_setRop(ILI9341PyObject *self, PyObject *args) {
+	char *name;
+
+	if (!PyArg_ParseTuple(args, "s", &name)) {
+		return NULL;
+	}
+
+	if (strcmp(name, "copy") == 0) {
+		self->rop = TFT_ROP_COPY;
+	} else if (strcmp(name, "xor") == 0) {
+		self->rop = TFT_ROP_XOR;
+	} else if (strcmp(name, "and") == 0) {
+		self->rop = TFT_ROP_AND;
+	} else if (strcmp(name, "or") == 0) {
+		self->rop = TFT_ROP_OR;
+	} else {
+		PyErr_Format(PyExc_ValueError, "unknown raster op %s", name);
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_floodFill(ILI9341PyObject *self, PyObject *args) {
+	int x, y, color;
+
+	if (!PyArg_ParseTuple(args, "iii", &x, &y, &color)) {
+		return NULL;
+	}
+
+	if (TFT_floodFill(self, x, y, color) < 0) {
+		return PyErr_NoMemory();
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_framebuffer(ILI9341PyObject *self, PyObject *args) {
+	int bpp;
+
+	if (!PyArg_ParseTuple(args, "i", &bpp)) {
+		return NULL;
+	}
+
+	if (bpp == 0) {
+		TFT_fbFree(self);
+		Py_RETURN_NONE;
+	}
+
+	if (bpp != 1 && bpp != 4 && bpp != 8) {
+		PyErr_SetString(PyExc_ValueError, "bpp must be 0, 1, 4 or 8");
+		return NULL;
+	}
+
+	if (TFT_fbAlloc(self, bpp) < 0) {
+		return PyErr_NoMemory();
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_palette(ILI9341PyObject *self, PyObject *args) {
+	int index, color = -1;
+
+	if (!PyArg_ParseTuple(args, "i|i", &index, &color)) {
+		return NULL;
+	}
+
+	if (index < 0 || index > 255) {
+		PyErr_SetString(PyExc_IndexError, "palette index out of range");
+		return NULL;
+	}
+
+	if (color < 0) {
+		return Py_BuildValue("i", self->palette[index]);
+	}
+
+	if (self->palette[index] != (color & 0xffff)) {
+		self->palette[index] = color;
+		self->pal_dirty[index] = 1;
+		self->pal_changed = 1;
+		if (self->fb != NULL) TFT_fbLut(self);
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_flush(ILI9341PyObject *self, PyObject *unused) {
+	if (self->fb != NULL) {
+		TFT_fbFlush(self);
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_gradientRect(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x, y, w, h, c0, c1, vertical = 1;
+	static char *kwlist[] = {"x", "y", "w", "h", "color0", "color1", "vertical", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iiiiii|i", kwlist, &x, &y, &w, &h, &c0, &c1, &vertical)) {
+		return NULL;
+	}
+
+	TFT_gradientRect(self, x, y, w, h, c0, c1, vertical);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_gradientCircle(ILI9341PyObject *self, PyObject *args) {
+	int x, y, r, c0, c1;
+
+	if (!PyArg_ParseTuple(args, "iiiii", &x, &y, &r, &c0, &c1)) {
+		return NULL;
+	}
+
+	if (r > TFT_MAX_RADIUS) {
+		PyErr_Format(PyExc_ValueError, "radius must be at most %d", TFT_MAX_RADIUS);
+		return NULL;
+	}
+
+	TFT_gradientCircle(self, x, y, r, c0, c1);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_bitmap(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x, y, w, h, fg, bg = -1, lsb = 0, len;
+	unsigned char *data;
+	PyObject *bgObj = Py_None;
+	static char *kwlist[] = {"data", "x", "y", "w", "h", "fg", "bg", "lsb_first", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#iiiii|Oi", kwlist, &data, &len, &x, &y, &w, &h, &fg, &bgObj, &lsb)) {
+		return NULL;
+	}
+
+	if (w <= 0 || h <= 0 || len < ((long long)w + 7) / 8 * h) {
+		PyErr_SetString(PyExc_ValueError, "data must be h rows of (w + 7) / 8 bytes");
+		return NULL;
+	}
+
+	if (bgObj != Py_None) {
+		bg = PyInt_AsLong(bgObj) & 0xffff;
+		if (PyErr_Occurred()) return NULL;
+	}
+
+	TFT_bitmap(self, x, y, w, h, data, lsb, fg, bg);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_blend(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	int x, y, w, h, len, cx, cy, cw, ch, j;
+	unsigned char *data, *buf;
+	static char *kwlist[] = {"data", "x", "y", "w", "h", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#iiii", kwlist, &data, &len, &x, &y, &w, &h)) {
+		return NULL;
+	}
+
+	if (TFT_areaSize(w, h, 4) != len) {
+		PyErr_SetString(PyExc_ValueError, "data must be w*h RGBA pixels");
+		return NULL;
+	}
+
+	cx = x; cy = y; cw = w; ch = h;
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) {
+		Py_RETURN_NONE;
+	}
+
+	if ((buf = malloc(cw * ch * 2)) == NULL) {
+		return PyErr_NoMemory();
+	}
+
+	TFT_readRect(self, cx, cy, cw, ch, buf);
+
+	data += ((cy - y) * w + (cx - x)) * 4;
+	for (j=0; j<ch; j++) {
+		pxBlendRGBA(buf + j * cw * 2, data + j * w * 4, cw);
+	}
+
+	TFT_blit(self, cx, cy, cw, ch, buf);
+	free(buf);
+
+	Py_RETURN_NONE;
+}
+
+static
+int gpioExport(int gpio) {
+	int fd, len, ret = -1;
+	char buf[255];
+
+	fd = open(SYSFS_GPIO_DIR "/export", O_WRONLY);
+	if (fd) {
 		len = snprintf(buf, sizeof(buf), "%d", gpio);
 		write(fd, buf, len);
 		close(fd);
-		ret = 0;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static
+int gpioSetDirection(int gpio, int direction) {
+	int fd, len, ret = -1;
+	char buf[255];
+
+	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/direction", gpio);
+    fd = open(buf, O_WRONLY);
+	
+	if (fd) {
+		if (direction) {
+			write(fd, "out", 3);
+		}
+		else {
+			write(fd, "in", 2);
+		}
+		close(fd);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static
+int gpioOpenSet(int gpio) {
+	char buf[255];
+
+	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+
+	return open(buf, O_WRONLY);
+}
+
+static
+void gpioCloseSet(int gpio_fd) {
+	if (gpio_fd) {
+		close(gpio_fd);
+	}
+}
+
+static
+void gpioSet(int gpio_fd, int value) {
+	if (gpio_fd) {
+		if (value) {
+			write(gpio_fd, "1", 2);
+		}
+		else {
+			write(gpio_fd, "0", 2);
+		}
+	}
+}
+
+static
+void TFT_sendByte(ILI9341PyObject *self, char data) {
+    struct spi_ioc_transfer xfer;
+   
+	memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (unsigned long)&data;
+    xfer.len = sizeof(char);
+
+    ioctl(self->fd, SPI_IOC_MESSAGE(1), &xfer);
+}
+
+static
+void TFT_sendCMD(ILI9341PyObject *self, int index) {
+    TFT_DC_LOW;
+    TFT_sendByte(self, index);
+}
+
+static
+void TFT_sendDATA(ILI9341PyObject *self, int data) {
+    TFT_DC_HIGH;
+    TFT_sendByte(self, data);
+}
+
+static
+void TFT_sendWord(ILI9341PyObject *self, int data) {
+    TFT_DC_HIGH;
+
+    TFT_sendByte(self, data >> 8);
+    TFT_sendByte(self, data & 0x00ff);
+}
+
+static
+void TFT_setCol(ILI9341PyObject *self, int StartCol, int EndCol) {
+	TFT_sendCMD(self, 0x2A);	// Column Command address
+	TFT_sendWord(self, StartCol);
+	TFT_sendWord(self, EndCol);
+}
+
+static
+void TFT_setPage(ILI9341PyObject *self, int StartPage, int EndPage) {
+	TFT_sendCMD(self, 0x2B);	// Column Command address
+	TFT_sendWord(self, StartPage);
+	TFT_sendWord(self, EndPage);
+}
+
+static
+void TFT_setXY(ILI9341PyObject *self, int poX, int poY) {
+	TFT_setCol(self, poX, poX);
+	TFT_setPage(self, poY, poY);
+	TFT_sendCMD(self, 0x2c);
+}
+
+static
+void TFT_setWindow(ILI9341PyObject *self, int x0, int y0, int x1, int y1) {
+	if (self->fb != NULL || self->rop != TFT_ROP_COPY) {
+		self->win_x0 = self->win_x = x0;
+		self->win_x1 = x1;
+		self->win_y = y0;
+		self->win_y1 = y1;
+		if (self->fb != NULL) TFT_fbDirty(self, x0, y0, x1, y1);
+		return;
+	}
+
+	TFT_panelWindow(self, x0, y0, x1, y1);
+}
+
+// big-endian RGB565 pixels for window set by TFT_setWindow, mapped to
+// nearest palette index when drawing to framebuffer. Raster ops other
+// than copy read the panel back a row piece at a time
+static
+void TFT_sendBuffer(ILI9341PyObject *self, unsigned char *buf, int len) {
+	unsigned char dst[ILI9341_TFTHEIGHT * 2];
+	int i, n, c;
+
+	if (self->fb != NULL) {
+		for (; len >= 2 && self->win_y <= self->win_y1; len -= 2, buf += 2) {
+			c = TFT_fbIndex(self, (buf[0] << 8) | buf[1]);
+			if (self->rop != TFT_ROP_COPY) c = TFT_rop(self->rop, TFT_fbGet(self, self->win_x, self->win_y), c);
+			TFT_fbSet(self, self->win_x, self->win_y, c);
+			if (++self->win_x > self->win_x1) {
+				self->win_x = self->win_x0;
+				self->win_y++;
+			}
+		}
+		return;
+	}
+
+	if (self->rop != TFT_ROP_COPY) {
+		while (len >= 2 && self->win_y <= self->win_y1) {
+			n = self->win_x1 - self->win_x + 1;
+			if (n > len / 2) n = len / 2;
+
+			TFT_readRect(self, self->win_x, self->win_y, n, 1, dst);
+			for (i=0; i<n*2; i+=2) {
+				c = TFT_rop(self->rop, (dst[i] << 8) | dst[i + 1], (buf[i] << 8) | buf[i + 1]);
+				dst[i] = c >> 8;
+				dst[i + 1] = c & 0xff;
+			}
+			TFT_panelWindow(self, self->win_x, self->win_y, self->win_x + n - 1, self->win_y);
+			TFT_panelSend(self, dst, n * 2);
+
+			buf += n * 2;
+			len -= n * 2;
+			if ((self->win_x += n) > self->win_x1) {
+				self->win_x = self->win_x0;
+				self->win_y++;
+			}
+		}
+		return;
+	}
+
+	TFT_panelSend(self, buf, len);
+}
+
+static inline
+int TFT_rop(int rop, int dst, int src) {
+	switch (rop) {
+		case TFT_ROP_XOR:
+			return dst ^ src;
+		case TFT_ROP_AND:
+			return dst & src;
+		case TFT_ROP_OR:
+			return dst | src;
+		default:
+			return src;
+	}
+}
+
+static
+void TFT_panelWindow(ILI9341PyObject *self, int x0, int y0, int x1, int y1) {
+	TFT_setCol(self, x0, x1);
+	TFT_setPage(self, y0, y1);
+	TFT_sendCMD(self, ILI9341_RAMWR);
+}
+
+// send pixel data in spidev sized chunks, DC must stay high
+static
+void TFT_panelSend(ILI9341PyObject *self, unsigned char *buf, int len) {
+	struct spi_ioc_transfer xfer;
+	int n;
+
+	TFT_DC_HIGH;
+
+	while (len > 0) {
+		n = len > SPI_TX_BUFSIZE ? SPI_TX_BUFSIZE : len;
+
+		memset(&xfer, 0, sizeof(xfer));
+		xfer.tx_buf = (unsigned long)buf;
+		xfer.len = n;
+
+		ioctl(self->fd, SPI_IOC_MESSAGE(1), &xfer);
+
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Indexed framebuffer. Pixels hold palette indices, 8, 4 or 1 bits each,
+ * leftmost pixel in the high bits of a byte. Rows remember their dirty span
+ * and TFT_fbFlush expands only those through fb_lut, a whole byte at a time.
+ */
+static inline
+int TFT_fbGet(ILI9341PyObject *self, int x, int y) {
+	unsigned char b = self->fb[y * self->fb_stride + x * self->fb_bpp / 8];
+
+	switch (self->fb_bpp) {
+		case 4:
+			return (x & 1) ? b & 0x0f : b >> 4;
+		case 1:
+			return (b >> (7 - (x & 7))) & 1;
+		default:
+			return b;
+	}
+}
+
+static inline
+void TFT_fbSet(ILI9341PyObject *self, int x, int y, int index) {
+	unsigned char *b = &self->fb[y * self->fb_stride + x * self->fb_bpp / 8];
+	int shift;
+
+	switch (self->fb_bpp) {
+		case 4:
+			shift = (x & 1) ? 0 : 4;
+			*b = (*b & ~(0x0f << shift)) | ((index & 0x0f) << shift);
+			break;
+		case 1:
+			shift = 7 - (x & 7);
+			*b = (*b & ~(1 << shift)) | ((index & 1) << shift);
+			break;
+		default:
+			*b = index;
+			break;
+	}
+}
+
+static
+void TFT_fbDirty(ILI9341PyObject *self, int x0, int y0, int x1, int y1) {
+	short *d;
+
+	for (; y0<=y1; y0++) {
+		d = &self->fb_dirty[y0 * 2];
+		if (d[0] > x0) d[0] = x0;
+		if (d[1] < x1) d[1] = x1;
+	}
+}
+
+static
+void TFT_fbLut(ILI9341PyObject *self) {
+	int b, i, n = 8 / self->fb_bpp, mask = (1 << self->fb_bpp) - 1, c;
+	unsigned char *p = self->fb_lut;
+
+	for (b=0; b<256; b++) {
+		for (i=0; i<n; i++) {
+			c = self->palette[(b >> ((n - 1 - i) * self->fb_bpp)) & mask];
+			*p++ = c >> 8;
+			*p++ = c & 0xff;
+		}
+	}
+
+	self->inv_valid = 0;
+}
+
+// nearest palette index for RGB565 color, looked up by its top 4 bits per channel
+static
+int TFT_fbIndex(ILI9341PyObject *self, int color) {
+	int key = ((color >> 12) << 8) | (((color >> 7) & 0x0f) << 4) | ((color >> 1) & 0x0f);
+	int k, i, n = 1 << self->fb_bpp, c, r, g, b, dr, dg, db, d, best, best_d;
+
+	if (!self->inv_valid) {
+		for (k=0; k<4096; k++) {
+			r = ((k >> 8) & 0x0f) * 17;
+			g = ((k >> 4) & 0x0f) * 17;
+			b = (k & 0x0f) * 17;
+			best = 0;
+			best_d = INT_MAX;
+
+			for (i=0; i<n; i++) {
+				c = self->palette[i];
+				dr = r - (((c >> 11) & 0x1f) * 255 / 31);
+				dg = g - (((c >> 5) & 0x3f) * 255 / 63);
+				db = b - ((c & 0x1f) * 255 / 31);
+				d = dr * dr + dg * dg + db * db;
+				if (d < best_d) {
+					best_d = d;
+					best = i;
+				}
+			}
+			self->inv_lut[k] = best;
+		}
+		self->inv_valid = 1;
+	}
+
+	return self->inv_lut[key];
+}
+
+// named colors, then 6x6x6 color cube and gray ramp like xterm
+static
+void TFT_defaultPalette(ILI9341PyObject *self) {
+	static const unsigned short named[16] = {
+		ILI9341_BLACK, ILI9341_WHITE, ILI9341_RED, ILI9341_GREEN,
+		ILI9341_BLUE, ILI9341_CYAN, ILI9341_MAGENTA, ILI9341_YELLOW,
+		ILI9341_ORANGE, ILI9341_NAVY, ILI9341_DARKGREEN, ILI9341_DARKCYAN,
+		ILI9341_MAROON, ILI9341_PURPLE, ILI9341_OLIVE, ILI9341_LIGHTGREY
+	};
+	int i, v;
+
+	for (i=0; i<256; i++) {
+		if (i < 16) {
+			self->palette[i] = named[i];
+		} else if (i < 232) {
+			self->palette[i] = TFT_rgb2color(self, (i - 16) / 36 * 51, (i - 16) / 6 % 6 * 51, (i - 16) % 6 * 51);
+		} else {
+			v = (i - 232) * 10 + 8;
+			self->palette[i] = TFT_rgb2color(self, v, v, v);
+		}
+	}
+}
+
+static
+int TFT_fbAlloc(ILI9341PyObject *self, int bpp) {
+	int y;
+
+	TFT_fbFree(self);
+
+	self->fb_bpp = bpp;
+	self->fb_stride = (self->width * bpp + 7) / 8;
+	self->fb = calloc(self->fb_stride * self->height, 1);
+	self->fb_dirty = malloc(self->height * 2 * sizeof(short));
+	if (self->fb == NULL || self->fb_dirty == NULL) {
+		TFT_fbFree(self);
+		return -1;
+	}
+
+	memset(self->pal_dirty, 0, sizeof(self->pal_dirty));
+	self->pal_changed = 0;
+	TFT_fbLut(self);
+
+	// first flush sends everything
+	for (y=0; y<self->height; y++) {
+		self->fb_dirty[y * 2] = 0;
+		self->fb_dirty[y * 2 + 1] = self->width - 1;
+	}
+
+	return 0;
+}
+
+static
+void TFT_fbFree(ILI9341PyObject *self) {
+	free(self->fb);
+	free(self->fb_dirty);
+	self->fb = NULL;
+	self->fb_dirty = NULL;
+}
+
+// which fb bytes hold an index whose palette entry changed
+static
+void TFT_fbChangedBytes(ILI9341PyObject *self, unsigned char *changed) {
+	int b, i, n = 8 / self->fb_bpp, mask = (1 << self->fb_bpp) - 1;
+
+	for (b=0; b<256; b++) {
+		changed[b] = 0;
+		for (i=0; i<n; i++) {
+			changed[b] |= self->pal_dirty[(b >> (i * self->fb_bpp)) & mask];
+		}
+	}
+}
+
+static
+void TFT_fbFlush(ILI9341PyObject *self) {
+	unsigned char changed[256], *row;
+	int px = 8 / self->fb_bpp, size = px * 2;
+	int x, y, y0, bx0, bx1, last, i;
+	short *d;
+
+	// palette changes dirty every pixel using changed entries
+	if (self->pal_changed) {
+		TFT_fbChangedBytes(self, changed);
+
+		for (y=0; y<self->height; y++) {
+			row = self->fb + y * self->fb_stride;
+			d = &self->fb_dirty[y * 2];
+
+			for (x=0; x<self->fb_stride; x++) {
+				if (changed[row[x]]) {
+					if (d[0] > x * px) d[0] = x * px;
+					if (d[1] < x * px + px - 1) d[1] = x * px + px - 1;
+				}
+			}
+		}
+
+		memset(self->pal_dirty, 0, sizeof(self->pal_dirty));
+		self->pal_changed = 0;
+	}
+
+	for (y=0; y<self->height; ) {
+		d = &self->fb_dirty[y * 2];
+		if (d[0] > d[1]) {
+			y++;
+			continue;
+		}
+
+		// widen to whole fb bytes, following rows with same span share the window
+		bx0 = d[0] / px;
+		bx1 = d[1] / px;
+		for (y0=y++; y<self->height; y++) {
+			d = &self->fb_dirty[y * 2];
+			if (d[0] > d[1] || d[0] / px != bx0 || d[1] / px != bx1) break;
+		}
+
+		// last byte may hang over the right edge
+		last = (bx1 + 1) * px > self->width ? (self->width - bx1 * px) * 2 : size;
+		TFT_panelWindow(self, bx0 * px, y0, bx1 * px + last / 2 - 1, y - 1);
+
+		for (i=y0; i<y; i++) {
+			row = self->fb + i * self->fb_stride;
+
+			for (x=bx0; x<=bx1; x++) {
+				if (self->tx_len + size > SPI_TX_BUFSIZE) {
+					TFT_panelSend(self, self->tx_buf, self->tx_len);
+					self->tx_len = 0;
+				}
+				memcpy(self->tx_buf + self->tx_len, self->fb_lut + row[x] * size, x == bx1 ? last : size);
+				self->tx_len += x == bx1 ? last : size;
+			}
+
+			self->fb_dirty[i * 2] = self->width;
+			self->fb_dirty[i * 2 + 1] = -1;
+		}
+
+		TFT_panelSend(self, self->tx_buf, self->tx_len);
+		self->tx_len = 0;
+	}
+}
+
+// queue pixel data in tx buffer, sent when full or on TFT_flush
+static
+void TFT_pushBytes(ILI9341PyObject *self, unsigned char *data, int len) {
+	int n;
+
+	while (len > 0) {
+		if (self->tx_len == SPI_TX_BUFSIZE) {
+			TFT_flush(self);
+		}
+
+		n = SPI_TX_BUFSIZE - self->tx_len;
+		if (n > len) n = len;
+
+		memcpy(self->tx_buf + self->tx_len, data, n);
+		self->tx_len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+static
+void TFT_flush(ILI9341PyObject *self) {
+	if (self->tx_len) {
+		TFT_sendBuffer(self, self->tx_buf, self->tx_len);
+		self->tx_len = 0;
+	}
+}
+
+static
+void TFT_resetClip(ILI9341PyObject *self) {
+	self->clip_x0 = 0;
+	self->clip_y0 = 0;
+	self->clip_x1 = self->width - 1;
+	self->clip_y1 = self->height - 1;
+}
+
+// clip rect against current clip area, returns 0 if nothing left to draw
+static
+int TFT_clipRect(ILI9341PyObject *self, int *x, int *y, int *w, int *h) {
+	int x1 = *x + *w - 1, y1 = *y + *h - 1;
+
+	if (*x < self->clip_x0) *x = self->clip_x0;
+	if (*y < self->clip_y0) *y = self->clip_y0;
+	if (x1 > self->clip_x1) x1 = self->clip_x1;
+	if (y1 > self->clip_y1) y1 = self->clip_y1;
+
+	*w = x1 - *x + 1;
+	*h = y1 - *y + 1;
+
+	return (*w > 0 && *h > 0);
+}
+
+// bytes of w*h pixels, 64-bit so sizes passed from Python can't wrap around,
+// -1 unless both w and h are positive
+static
+long long TFT_areaSize(int w, int h, int bpp) {
+	if (w <= 0 || h <= 0) return -1;
+
+	return (long long)w * h * bpp;
+}
+
+// offset from a center that may be far off screen, limited to lo..hi
+static
+int TFT_clamp(long long v, int lo, int hi) {
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static
+void TFT_fillRect(ILI9341PyObject *self, int x, int y, int w, int h, int color) {
+	int i, n;
+
+	if (!TFT_clipRect(self, &x, &y, &w, &h)) return;
+
+	// framebuffer drawing takes palette index for color
+	if (self->fb != NULL) {
+		TFT_fbDirty(self, x, y, x + w - 1, y + h - 1);
+		for (n=y; n<y+h; n++) {
+			if (self->fb_bpp == 8 && self->rop == TFT_ROP_COPY) {
+				memset(self->fb + n * self->fb_stride + x, color, w);
+			} else {
+				for (i=x; i<x+w; i++) TFT_fbSet(self, i, n, TFT_rop(self->rop, TFT_fbGet(self, i, n), color));
+			}
+		}
+		return;
+	}
+
+	TFT_fillWindow(self, x, y, w, h, color);
+}
+
+// solid RGB565 rect, already clipped. Unlike TFT_fillRect color is never a
+// palette index, framebuffer maps it to nearest one
+static
+void TFT_fillWindow(ILI9341PyObject *self, int x, int y, int w, int h, int color) {
+	int i, n, len;
+
+	TFT_setWindow(self, x, y, x + w - 1, y + h - 1);
+
+	len = w * h * 2;
+	n = len > SPI_TX_BUFSIZE ? SPI_TX_BUFSIZE : len;
+
+	for (i=0; i<n; i+=2) {
+		self->tx_buf[i] = color >> 8;
+		self->tx_buf[i + 1] = color & 0xff;
+	}
+
+	while (len > 0) {
+		n = len > SPI_TX_BUFSIZE ? SPI_TX_BUFSIZE : len;
+		TFT_sendBuffer(self, self->tx_buf, n);
+		len -= n;
+	}
+}
+
+// data is w*h big-endian RGB565 pixels
+static
+void TFT_blit(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data) {
+	int cx = x, cy = y, cw = w, ch = h, j;
+
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) return;
+
+	data += ((cy - y) * w + (cx - x)) * 2;
+
+	TFT_setWindow(self, cx, cy, cx + cw - 1, cy + ch - 1);
+
+	if (cw == w) {
+		TFT_sendBuffer(self, data, cw * ch * 2);
+		return;
+	}
+
+	for (j=0; j<ch; j++) {
+		TFT_sendBuffer(self, data, cw * 2);
+		data += w * 2;
+	}
+}
+
+// like TFT_blit for w*h pixels of pxToRGB565 format, converted while sending
+static
+void TFT_blitFormat(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data, int format) {
+	int cx = x, cy = y, cw = w, ch = h, size = pxFormatSize(format), i, j, n;
+	unsigned char *p;
+	px_dither d;
+
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) return;
+
+	// ordered pattern stays anchored to the image when it is clipped, error
+	// diffusion starts at the first visible pixel
+	if (pxDitherInit(&d, self->dither, cx - x + cw) < 0) {
+		pxDitherInit(&d, PX_DITHER_NONE, 0);
+	}
+	pxDitherSetRow(&d, cy - y);
+
+	TFT_setWindow(self, cx, cy, cx + cw - 1, cy + ch - 1);
+
+	for (j=0; j<ch; j++) {
+		p = data + ((cy - y + j) * w + (cx - x)) * size;
+
+		for (i=0; i<cw; i+=n, p+=n * size) {
+			if (self->tx_len == SPI_TX_BUFSIZE) {
+				TFT_flush(self);
+			}
+
+			n = (SPI_TX_BUFSIZE - self->tx_len) / 2;
+			if (n > cw - i) n = cw - i;
+
+			pxDitherRow(&d, self->tx_buf + self->tx_len, p, cx - x + i, n, format);
+			self->tx_len += n * 2;
+		}
+
+		pxDitherNextRow(&d);
+	}
+
+	TFT_flush(self);
+	pxDitherDone(&d);
+}
+
+/*
+ * Gradients step RGB888 channels in 16.16 fixed point and go through the
+ * same dithering as true color images on their way to RGB565.
+ */
+static
+void TFT_rgb888(int color, int *rgb) {
+	rgb[0] = ((color >> 11) & 0x1f) * 255 / 31;
+	rgb[1] = ((color >> 5) & 0x3f) * 255 / 63;
+	rgb[2] = (color & 0x1f) * 255 / 31;
+}
+
+static
+void TFT_gradientRow(ILI9341PyObject *self, px_dither *d, unsigned char *rgb, int x, int n) {
+	int i, k;
+
+	for (i=0; i<n; i+=k, rgb+=k * 3) {
+		if (self->tx_len == SPI_TX_BUFSIZE) {
+			TFT_flush(self);
+		}
+
+		k = (SPI_TX_BUFSIZE - self->tx_len) / 2;
+		if (k > n - i) k = n - i;
+
+		pxDitherRow(d, self->tx_buf + self->tx_len, rgb, x + i, k, PX_RGB888);
+		self->tx_len += k * 2;
+	}
+
+	pxDitherNextRow(d);
+}
+
+// c0 at left or top edge to c1 at right or bottom one
+static
+void TFT_gradientRect(ILI9341PyObject *self, int x, int y, int w, int h, int c0, int c1, int vertical) {
+	unsigned char row[ILI9341_TFTHEIGHT * 3];
+	int cx = x, cy = y, cw = w, ch = h, from[3], to[3], v[3], step[3], len, i, j, k, c, run;
+	px_dither d;
+
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) return;
+
+	TFT_rgb888(c0, from);
+	TFT_rgb888(c1, to);
+	len = (vertical ? h : w) - 1;
+
+	// value at first visible column or row
+	for (k=0; k<3; k++) {
+		step[k] = len > 0 ? ((to[k] - from[k]) << 16) / len : 0;
+		v[k] = (from[k] << 16) + 0x8000 + step[k] * (vertical ? cy - y : cx - x);
+	}
+
+	// undithered vertical rows are solid, rows of same RGB565 share one fill
+	if (vertical && self->dither == PX_DITHER_NONE) {
+		for (j=0; j<ch; j+=run) {
+			c = TFT_rgb2color(self, v[0] >> 16, v[1] >> 16, v[2] >> 16);
+
+			for (run=0; j+run<ch && TFT_rgb2color(self, v[0] >> 16, v[1] >> 16, v[2] >> 16) == c; run++) {
+				for (k=0; k<3; k++) v[k] += step[k];
+			}
+
+			TFT_fillWindow(self, cx, cy + j, cw, run, c);
+		}
+		return;
+	}
+
+	if (pxDitherInit(&d, self->dither, cx - x + cw) < 0) {
+		pxDitherInit(&d, PX_DITHER_NONE, 0);
+	}
+	pxDitherSetRow(&d, cy - y);
+
+	TFT_setWindow(self, cx, cy, cx + cw - 1, cy + ch - 1);
+
+	for (j=0; j<ch; j++) {
+		if (vertical || j == 0) {
+			for (i=0; i<cw; i++) {
+				for (k=0; k<3; k++) {
+					row[i * 3 + k] = v[k] >> 16;
+					if (!vertical) v[k] += step[k];
+				}
+			}
+			if (vertical) {
+				for (k=0; k<3; k++) v[k] += step[k];
+			}
+		}
+
+		TFT_gradientRow(self, &d, row, cx - x, cw);
+	}
+
+	TFT_flush(self);
+	pxDitherDone(&d);
+}
+
+static
+unsigned int TFT_isqrt(unsigned int v) {
+	unsigned int r = 0, b = 1 << 30;
+
+	while (b > v) b >>= 2;
+
+	for (; b; b >>= 2) {
+		if (v >= r + b) {
+			v -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+	}
+
+	return r;
+}
+
+static
+unsigned long long TFT_isqrt64(unsigned long long v) {
+	unsigned long long r = 0, b = 1ULL << 62;
+
+	if (v <= 0xffffffffULL) return TFT_isqrt(v);
+
+	while (b > v) b >>= 2;
+
+	for (; b; b >>= 2) {
+		if (v >= r + b) {
+			v -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+	}
+
+	return r;
+}
+
+// c0 in the center to c1 at radius r, one window per row span
+static
+void TFT_gradientCircle(ILI9341PyObject *self, int x0, int y0, int r, int c0, int c1) {
+	unsigned char row[ILI9341_TFTHEIGHT * 3];
+	int from[3], to[3], dx, dy, dy0, dy1, hw, sx, sw, i, k, t;
+	long long left, ox, lo, hi, d2, dist, inv;
+	px_dither d;
+
+	if (r <= 0 || r > TFT_MAX_RADIUS) return;
+
+	// only rows and columns inside the clip area, center may be far off
+	// screen so bounds are 64-bit
+	dy0 = TFT_clamp((long long)self->clip_y0 - y0, -r, r + 1);
+	dy1 = TFT_clamp((long long)self->clip_y1 - y0, -r - 1, r);
+
+	left = (long long)x0 - r;
+	lo = left > self->clip_x0 ? left : self->clip_x0;
+	hi = (long long)x0 + r < self->clip_x1 ? (long long)x0 + r : self->clip_x1;
+	if (dy0 > dy1 || lo > hi) return;
+
+	TFT_rgb888(c0, from);
+	TFT_rgb888(c1, to);
+
+	// distance has 4 fraction bits, t is 0..65536 from center to edge
+	inv = (1LL << 40) / r;
+
+	// dither columns start at a multiple of 4 from the circle's left edge,
+	// rows count from its top, so the pattern doesn't move with clipping
+	ox = left + ((lo - left) & ~3LL);
+	if (pxDitherInit(&d, self->dither, hi - ox + 1) < 0) {
+		pxDitherInit(&d, PX_DITHER_NONE, 0);
+	}
+	pxDitherSetRow(&d, dy0 + r);
+
+	for (dy=dy0; dy<=dy1; dy++) {
+		hw = TFT_isqrt64((long long)r * r - (long long)dy * dy);
+		lo = (long long)x0 - hw > self->clip_x0 ? (long long)x0 - hw : self->clip_x0;
+		hi = (long long)x0 + hw < self->clip_x1 ? (long long)x0 + hw : self->clip_x1;
+
+		if (lo > hi) {
+			pxDitherNextRow(&d);
+			continue;
+		}
+
+		sx = lo;
+		sw = hi - lo + 1;
+
+		// squared distance steps by 2 * dx + 1 along the span
+		dx = sx - x0;
+		d2 = (long long)dx * dx + (long long)dy * dy;
+
+		for (i=0; i<sw; i++, dx++) {
+			dist = TFT_isqrt64(d2 << 8);
+			t = (dist * inv) >> 28;
+			if (t > 65536) t = 65536;
+
+			for (k=0; k<3; k++) {
+				row[i * 3 + k] = from[k] + (((to[k] - from[k]) * (t >> 4) + 2048) >> 12);
+			}
+
+			d2 += 2 * dx + 1;
+		}
+
+		TFT_setWindow(self, sx, y0 + dy, sx + sw - 1, y0 + dy);
+		TFT_gradientRow(self, &d, row, sx - ox, sw);
+		TFT_flush(self);
+	}
+
+	pxDitherDone(&d);
+}
+
+/*
+ * Shapes are made of horizontal spans computed with integers only, angles
+ * are whole degrees clockwise from 3 o'clock looked up in a Q14 sine table.
+ */
+static const short TFT_sineTable[91] = {
+	0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+	2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+	5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+	8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+	10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+	12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+	14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+	15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+	16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+	16384
+};
+
+static
+int TFT_sin(int deg) {
+	deg = (deg % 360 + 360) % 360;
+
+	if (deg < 90) return TFT_sineTable[deg];
+	if (deg < 180) return TFT_sineTable[180 - deg];
+	if (deg < 270) return -TFT_sineTable[deg - 180];
+
+	return -TFT_sineTable[360 - deg];
+}
+
+static
+int TFT_cos(int deg) {
+	return TFT_sin(deg + 90);
+}
+
+static
+long long TFT_divFloor(long long a, long long b) {
+	long long q = a / b;
+
+	if (a % b != 0 && (a < 0) != (b < 0)) q--;
+
+	return q;
+}
+
+// narrow [lo, hi] to dx where a * dx + b >= 0, empty range keeps lo > hi
+static
+void TFT_halfPlane(int a, long long b, int *lo, int *hi) {
+	long long v;
+
+	if (a > 0) {
+		v = -TFT_divFloor(b, a);
+		if (*lo < v) *lo = v > *hi ? *hi + 1 : v;
+	} else if (a < 0) {
+		v = TFT_divFloor(b, -a);
+		if (*hi > v) *hi = v < *lo ? *lo - 1 : v;
+	} else if (b < 0) {
+		*lo = 1;
+		*hi = 0;
+	}
+}
+
+// spans of ring between radius r and ri (exclusive, none if ri < 0) at row
+// dy, as dx offsets from the center. Returns number of spans
+static
+int TFT_ringSpans(int dy, int r, int ri, int *sp) {
+	int ho, hi;
+
+	if (dy < -r || dy > r) return 0;
+
+	// + r rounds to nearest like the midpoint circle algorithm
+	ho = TFT_isqrt64((long long)r * r + r - (long long)dy * dy);
+	if (ri < 0 || dy < -ri || dy > ri) {
+		sp[0] = -ho;
+		sp[1] = ho;
+		return 1;
+	}
+
+	// keep at least one pixel so thin rings have no gaps
+	hi = TFT_isqrt64((long long)ri * ri + ri - (long long)dy * dy);
+	if (hi >= ho) hi = ho - 1;
+
+	sp[0] = -ho;
+	sp[1] = -hi - 1;
+	sp[2] = hi + 1;
+	sp[3] = ho;
+
+	return 2;
+}
+
+// ring between radius r and r - thickness, from angle start to end
+static
+void TFT_arc(ILI9341PyObject *self, int x0, int y0, int r, int start, int end, int thickness, int color) {
+	int s0 = TFT_sin(start), c0 = TFT_cos(start), s1 = TFT_sin(end), c1 = TFT_cos(end);
+	int sweep = end - start, dy, dy0, dy1, xl, xr, ring[4], sector[4], nr, ns, i, j, a, b, lo, hi;
+
+	if (r < 0 || r > TFT_MAX_RADIUS || thickness <= 0) return;
+
+	if (sweep < 360 && sweep > -360) {
+		sweep = (sweep % 360 + 360) % 360;
+	}
+
+	// only rows and columns inside the clip area, spans stay within xl..xr
+	dy0 = TFT_clamp((long long)self->clip_y0 - y0, -r, r + 1);
+	dy1 = TFT_clamp((long long)self->clip_y1 - y0, -r - 1, r);
+	xl = TFT_clamp((long long)self->clip_x0 - x0, -r, r + 1);
+	xr = TFT_clamp((long long)self->clip_x1 - x0, -r - 1, r);
+	if (xl > xr) return;
+
+	for (dy=dy0; dy<=dy1; dy++) {
+		nr = TFT_ringSpans(dy, r, r - thickness, ring);
+
+		// point is clockwise of start and counterclockwise of end, for
+		// sweeps over 180 degrees it is outside of the remaining sector
+		lo = xl;
+		hi = xr;
+		if (sweep >= 360 || sweep <= -360) {
+			ns = 1;
+		} else if (sweep <= 180) {
+			TFT_halfPlane(-s0, (long long)c0 * dy, &lo, &hi);
+			TFT_halfPlane(s1, -(long long)c1 * dy, &lo, &hi);
+			ns = 1;
+		} else {
+			TFT_halfPlane(-s1, (long long)c1 * dy - 1, &lo, &hi);
+			TFT_halfPlane(s0, -(long long)c0 * dy - 1, &lo, &hi);
+			if (lo > hi) {
+				lo = xl;
+				hi = xr;
+				ns = 1;
+			} else {
+				sector[2] = hi + 1;
+				sector[3] = xr;
+				hi = lo - 1;
+				lo = xl;
+				ns = 2;
+			}
+		}
+		sector[0] = lo;
+		sector[1] = hi;
+
+		for (i=0; i<nr; i++) {
+			for (j=0; j<ns; j++) {
+				a = ring[i * 2] > sector[j * 2] ? ring[i * 2] : sector[j * 2];
+				b = ring[i * 2 + 1] < sector[j * 2 + 1] ? ring[i * 2 + 1] : sector[j * 2 + 1];
+				if (a <= b) TFT_fillRect(self, x0 + a, y0 + dy, b - a + 1, 1, color);
+			}
+		}
+	}
+}
+
+static
+void TFT_roundRect(ILI9341PyObject *self, int x, int y, int w, int h, int r, int color, int fill) {
+	int j, j1, dy, n, sp[4], xl, xr;
+
+	if (w <= 0 || h <= 0) return;
+
+	if (r > w / 2) r = w / 2;
+	if (r > h / 2) r = h / 2;
+	if (r < 0) r = 0;
+
+	// no corners, outline needs its top and bottom edges
+	if (r == 0) {
+		if (fill) {
+			TFT_fillRect(self, x, y, w, h, color);
+		} else {
+			TFT_rect(self, x, y, w, h, color);
+		}
+		return;
+	}
+
+	xl = x + r;
+	xr = x + w - 1 - r;
+
+	// corner rows inside the clip area, left and right halves of circles
+	// centered on xl and xr
+	j = TFT_clamp((long long)self->clip_y0 - y, 0, h);
+	j1 = TFT_clamp((long long)self->clip_y1 - y, -1, h - 1);
+	for (; j<=j1; j++) {
+		if (j < r) {
+			dy = j - r;
+		} else if (j >= h - r) {
+			dy = j - (h - 1 - r);
+		} else {
+			j = h - r - 1;
+			continue;
+		}
+
+		n = TFT_ringSpans(dy, r, fill ? -1 : r - 1, sp);
+		if (n == 1) {
+			TFT_fillRect(self, xl + sp[0], y + j, xr - xl + 2 * sp[1] + 1, 1, color);
+		} else if (n == 2) {
+			TFT_fillRect(self, xl + sp[0], y + j, sp[1] - sp[0] + 1, 1, color);
+			TFT_fillRect(self, xr + sp[2], y + j, sp[3] - sp[2] + 1, 1, color);
+		}
+	}
+
+	// straight middle part
+	if (h - 2 * r > 0) {
+		if (fill) {
+			TFT_fillRect(self, x, y + r, w, h - 2 * r, color);
+		} else {
+			TFT_fillRect(self, x, y + r, 1, h - 2 * r, color);
+			TFT_fillRect(self, x + w - 1, y + r, 1, h - 2 * r, color);
+		}
+	}
+}
+
+static
+int TFT_divRound(int a, int b) {
+	return a >= 0 ? (a + b / 2) / b : -((-a + b / 2) / b);
+}
+
+// convex polygon of n points (x, y pairs), one span per row
+static
+void TFT_fillConvex(ILI9341PyObject *self, const int *pt, int n, int color) {
+	int i, y, ymin = pt[1], ymax = pt[1], xl, xr, ax, ay, bx, by, t;
+
+	for (i=1; i<n; i++) {
+		if (pt[i * 2 + 1] < ymin) ymin = pt[i * 2 + 1];
+		if (pt[i * 2 + 1] > ymax) ymax = pt[i * 2 + 1];
+	}
+
+	for (y=ymin; y<=ymax; y++) {
+		xl = INT_MAX;
+		xr = INT_MIN;
+
+		for (i=0; i<n; i++) {
+			ax = pt[i * 2];
+			ay = pt[i * 2 + 1];
+			bx = pt[(i + 1) % n * 2];
+			by = pt[(i + 1) % n * 2 + 1];
+			if (ay > by) {
+				t = ax; ax = bx; bx = t;
+				t = ay; ay = by; by = t;
+			}
+			if (y < ay || y > by) continue;
+
+			if (ay == by) {
+				if (ax < xl) xl = ax;
+				if (bx < xl) xl = bx;
+				if (ax > xr) xr = ax;
+				if (bx > xr) xr = bx;
+			} else {
+				t = ax + TFT_divRound((y - ay) * (bx - ax), by - ay);
+				if (t < xl) xl = t;
+				if (t > xr) xr = t;
+			}
+		}
+
+		if (xl <= xr) TFT_fillRect(self, xl, y, xr - xl + 1, 1, color);
+	}
+}
+
+// line width pixels wide with square ends at the end points
+static
+void TFT_thickLine(ILI9341PyObject *self, int x0, int y0, int x1, int y1, int width, int color) {
+	int dx = x1 - x0, dy = y1 - y0, len, a, b, pt[8];
+
+	if (width <= 1) {
+		TFT_line(self, x0, y0, x1, y1, color);
+		return;
+	}
+
+	// axis aligned lines are rects
+	if (dx == 0 || dy == 0) {
+		a = (width - 1) / 2;
+		if (dx == 0) {
+			TFT_fillRect(self, x0 - a, y0 < y1 ? y0 : y1, width, abs(dy) + 1, color);
+		} else {
+			TFT_fillRect(self, x0 < x1 ? x0 : x1, y0 - a, abs(dx) + 1, width, color);
+		}
+		return;
+	}
+
+	len = TFT_isqrt(dx * dx + dy * dy);
+	a = (width - 1) / 2;
+	b = width - 1 - a;
+
+	pt[0] = x0 + TFT_divRound(-dy * a, len);
+	pt[1] = y0 + TFT_divRound(dx * a, len);
+	pt[2] = x1 + TFT_divRound(-dy * a, len);
+	pt[3] = y1 + TFT_divRound(dx * a, len);
+	pt[4] = x1 - TFT_divRound(-dy * b, len);
+	pt[5] = y1 - TFT_divRound(dx * b, len);
+	pt[6] = x0 - TFT_divRound(-dy * b, len);
+	pt[7] = y0 - TFT_divRound(dx * b, len);
+
+	TFT_fillConvex(self, pt, 4, color);
+}
+
+// 1 bit per pixel rows padded to bytes, MSB or LSB (XBM) first. Set bits
+// are fg, clear ones bg or left untouched when bg is negative
+static
+void TFT_bitmap(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data, int lsb, int fg, int bg) {
+	int cx = x, cy = y, cw = w, ch = h, stride = (w + 7) / 8, i, j, k, on;
+	unsigned char *row;
+
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) return;
+
+#define BITMAP_BIT(i) (lsb ? row[(i) >> 3] & (1 << ((i) & 7)) : row[(i) >> 3] & (0x80 >> ((i) & 7)))
+
+	// runs of set bits, framebuffer colors are palette indices so it takes this path too
+	if (bg < 0 || self->fb != NULL) {
+		for (j=0; j<ch; j++) {
+			row = data + (cy - y + j) * stride;
+
+			for (i=cx-x; i<cx-x+cw; i=k) {
+				on = BITMAP_BIT(i) != 0;
+				for (k=i+1; k<cx-x+cw && (BITMAP_BIT(k) != 0) == on; k++);
+
+				if (on) {
+					TFT_fillRect(self, x + i, cy + j, k - i, 1, fg);
+				} else if (bg >= 0) {
+					TFT_fillRect(self, x + i, cy + j, k - i, 1, bg);
+				}
+			}
+		}
+		return;
+	}
+
+	// expand rows straight into tx buffer, whole bitmap is one window
+	TFT_setWindow(self, cx, cy, cx + cw - 1, cy + ch - 1);
+
+	for (j=0; j<ch; j++) {
+		row = data + (cy - y + j) * stride;
+
+		for (i=cx-x; i<cx-x+cw; i++) {
+			if (self->tx_len == SPI_TX_BUFSIZE) {
+				TFT_flush(self);
+			}
+
+			k = BITMAP_BIT(i) ? fg : bg;
+			self->tx_buf[self->tx_len++] = k >> 8;
+			self->tx_buf[self->tx_len++] = k & 0xff;
+		}
+	}
+
+#undef BITMAP_BIT
+
+	TFT_flush(self);
+}
+
+static
+int TFT_streamOpen(tft_stream *st, unsigned char *data, int len, const char *magic) {
+	int n = strlen(magic);
+
+	st->fd = -1;
+	st->p = data;
+	st->end = data + len;
+
+	if (len >= n && memcmp(data, magic, n) == 0) return 0;
+
+	// not image data, take it as file name
+	if ((st->fd = open((char *)data, O_RDONLY)) < 0) return -1;
+	st->p = st->end = st->buf;
+
+	return 0;
+}
+
+static
+void TFT_streamClose(tft_stream *st) {
+	if (st->fd >= 0) close(st->fd);
+}
+
+// copy n bytes, returns -1 when data ends early
+static
+int TFT_streamRead(tft_stream *st, unsigned char *dst, int n) {
+	int k;
+
+	while (n > 0) {
+		if (st->p == st->end) {
+			if (st->fd < 0 || (k = read(st->fd, st->buf, sizeof(st->buf))) <= 0) return -1;
+			st->p = st->buf;
+			st->end = st->buf + k;
+		}
+
+		k = st->end - st->p;
+		if (k > n) k = n;
+		memcpy(dst, st->p, k);
+		st->p += k;
+		dst += k;
+		n -= k;
+	}
+
+	return 0;
+}
+
+// queue n pixels of one color in tx buffer
+static
+void TFT_pushRun(ILI9341PyObject *self, int color, int n) {
+	for (; n > 0; n--) {
+		if (self->tx_len == SPI_TX_BUFSIZE) {
+			TFT_flush(self);
+		}
+
+		self->tx_buf[self->tx_len++] = color >> 8;
+		self->tx_buf[self->tx_len++] = color & 0xff;
+	}
+}
+
+// draw n pixels starting at image offset pos, run of color or literal pixels
+static
+void TFT_rleEmit(ILI9341PyObject *self, int x, int y, int w, int cx, int cy, int cw, int ch,
+		long long pos, int n, int color, unsigned char *lit) {
+	int col, row, a, b;
+
+	while (n > 0) {
+		col = pos % w;
+		row = pos / w;
+		b = col + n > w ? w : col + n;
+
+		// visible part of this row
+		a = col < cx - x ? cx - x : col;
+		if (b > cx - x + cw) b = cx - x + cw;
+		if (row >= cy - y && row < cy - y + ch && a < b) {
+			if (self->fb != NULL && lit == NULL) {
+				TFT_fillRect(self, x + a, y + row, b - a, 1, TFT_fbIndex(self, color));
+			} else if (self->fb != NULL) {
+				TFT_setWindow(self, x + a, y + row, x + b - 1, y + row);
+				TFT_sendBuffer(self, lit + (a - col) * 2, (b - a) * 2);
+			} else if (lit == NULL) {
+				TFT_pushRun(self, color, b - a);
+			} else {
+				TFT_pushBytes(self, lit + (a - col) * 2, (b - a) * 2);
+			}
+		}
+
+		a = (col + n > w ? w : col + n) - col;
+		pos += a;
+		n -= a;
+		if (lit != NULL) lit += a * 2;
+	}
+}
+
+// returns -1 if data is not valid
+static
+int TFT_rleImage(ILI9341PyObject *self, tft_stream *st, int x, int y) {
+	unsigned char hdr[8], lit[128 * 2];
+	int w, h, cx, cy, cw, ch, n, c, color = 0;
+	long long pos, total;
+
+	if (TFT_streamRead(st, hdr, 8) < 0 || memcmp(hdr, RLE_MAGIC, 4) != 0) return -1;
+
+	w = (hdr[4] << 8) | hdr[5];
+	h = (hdr[6] << 8) | hdr[7];
+	// 16-bit sides, product may not fit an int
+	total = (long long)w * h;
+
+	cx = x; cy = y; cw = w; ch = h;
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) return 0;
+
+	// visible pixels arrive in window order, one window takes them all
+	if (self->fb == NULL) {
+		TFT_setWindow(self, cx, cy, cx + cw - 1, cy + ch - 1);
+	}
+
+	for (pos=0; pos<total; pos+=n) {
+		if (TFT_streamRead(st, hdr, 1) < 0) break;
+		c = hdr[0];
+		n = (c & 0x7f) + 1;
+
+		if (c & 0x80) {
+			if (TFT_streamRead(st, hdr, 2) < 0) break;
+			color = (hdr[0] << 8) | hdr[1];
+		} else if (TFT_streamRead(st, lit, n * 2) < 0) {
+			break;
+		}
+
+		if (n > total - pos) n = total - pos;
+		TFT_rleEmit(self, x, y, w, cx, cy, cw, ch, pos, n, color, (c & 0x80) ? NULL : lit);
+
+		// rows below the window need no decoding
+		if ((pos + n) / w >= cy - y + ch) {
+			pos = total;
+			break;
+		}
+	}
+
+	TFT_flush(self);
+
+	return pos < total ? -1 : 0;
+}
+
+// decompress LZ4 block, returns output length or -1 if data is corrupt
+static
+int TFT_lz4Decode(const unsigned char *src, int len, unsigned char *dst, int size) {
+	const unsigned char *ip = src, *iend = src + len, *m;
+	unsigned char *op = dst, *oend = dst + size;
+	int token, n, b, off;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		n = token >> 4;
+		if (n == 15) {
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				n += b;
+			} while (b == 255);
+		}
+		if (n > iend - ip || n > oend - op) return -1;
+		memcpy(op, ip, n);
+		ip += n;
+		op += n;
+
+		// last sequence has literals only
+		if (ip == iend) break;
+
+		if (iend - ip < 2) return -1;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (off == 0 || off > op - dst) return -1;
+
+		n = token & 0x0f;
+		if (n == 15) {
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				n += b;
+			} while (b == 255);
+		}
+		n += 4;
+		if (n > oend - op) return -1;
+
+		// match may overlap output, copy bytewise
+		for (m=op-off; n>0; n--) *op++ = *m++;
+	}
+
+	return op - dst;
+}
+
+// returns -1 if data is not valid or out of memory
+static
+int TFT_lz4Image(ILI9341PyObject *self, tft_stream *st, int x, int y) {
+	unsigned char hdr[10], *block = NULL, *packed = NULL, *row;
+	int w, h, rows, size, bound, cx, cy, cw, ch, j, a, b, n, len, ret = -1;
+	long long block_size;
+
+	if (TFT_streamRead(st, hdr, 10) < 0 || memcmp(hdr, LZ4_MAGIC, 4) != 0) return -1;
+
+	w = (hdr[4] << 8) | hdr[5];
+	h = (hdr[6] << 8) | hdr[7];
+	rows = (hdr[8] << 8) | hdr[9];
+	block_size = TFT_areaSize(w, rows, 2);
+	if (block_size < 0 || block_size > LZ4_MAX_BLOCK) return -1;
+	size = block_size;
+
+	cx = x; cy = y; cw = w; ch = h;
+	if (!TFT_clipRect(self, &cx, &cy, &cw, &ch)) return 0;
+
+	// memory is one block and its largest compressed size
+	bound = size + size / 255 + 16;
+	block = malloc(size);
+	packed = malloc(bound);
+	if (block == NULL || packed == NULL) goto out;
+
+	TFT_setWindow(self, cx, cy, cx + cw - 1, cy + ch - 1);
+
+	for (j=0; j<cy-y+ch; j+=rows) {
+		if (TFT_streamRead(st, hdr, 4) < 0) goto out;
+		len = (hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+		n = (h - j < rows ? h - j : rows) * w * 2;
+
+		if (len < 0 || len > bound || TFT_streamRead(st, packed, len) < 0
+				|| TFT_lz4Decode(packed, len, block, n) != n) goto out;
+
+		// rows a..b of this block are inside the window
+		a = j < cy - y ? cy - y : j;
+		b = j + n / (w * 2);
+		if (b > cy - y + ch) b = cy - y + ch;
+		if (a >= b) continue;
+
+		row = block + (a - j) * w * 2;
+		n = b - a;
+
+		if (cw == w) {
+			TFT_sendBuffer(self, row, n * w * 2);
+		} else {
+			for (; n>0; n--, row+=w * 2) {
+				TFT_pushBytes(self, row + (cx - x) * 2, cw * 2);
+			}
+			TFT_flush(self);
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(block);
+	free(packed);
+
+	return ret;
+}
+
+static
+int TFT_pixelFormat(const char *name) {
+	if (strcmp(name, "rgb") == 0) return PX_RGB888;
+	if (strcmp(name, "bgr") == 0) return PX_BGR888;
+	if (strcmp(name, "rgbx") == 0) return PX_RGBX8888;
+	if (strcmp(name, "gray") == 0) return PX_GRAY8;
+
+	return -1;
+}
+
+static
+int TFT_ditherMode(const char *name) {
+	if (strcmp(name, "none") == 0) return PX_DITHER_NONE;
+	if (strcmp(name, "ordered") == 0) return PX_DITHER_ORDERED;
+	if (strcmp(name, "fs") == 0) return PX_DITHER_FS;
+
+	return -1;
+}
+
+// read back w*h pixels as big-endian RGB565, rect must be on screen.
+// Panel answers RAMRD with a dummy byte and then RGB666, one byte per channel
+static
+void TFT_readRect(ILI9341PyObject *self, int x, int y, int w, int h, unsigned char *data) {
+	struct spi_ioc_transfer xfer;
+	unsigned char rx[1 + ILI9341_TFTHEIGHT * 3];	/* tx_buf may hold pixels being sent */
+	int i, j, c;
+
+	if (self->fb != NULL) {
+		for (j=y; j<y+h; j++) {
+			for (i=x; i<x+w; i++) {
+				c = self->palette[TFT_fbGet(self, i, j)];
+				*data++ = c >> 8;
+				*data++ = c & 0xff;
+			}
+		}
+		return;
+	}
+
+	for (j=0; j<h; j++) {
+		TFT_setCol(self, x, x + w - 1);
+		TFT_setPage(self, y + j, y + j);
+		TFT_sendCMD(self, ILI9341_RAMRD);
+
+		TFT_DC_HIGH;
+
+		memset(&xfer, 0, sizeof(xfer));
+		xfer.rx_buf = (unsigned long)rx;
+		xfer.len = 1 + w * 3;
+
+		ioctl(self->fd, SPI_IOC_MESSAGE(1), &xfer);
+
+		pxToRGB565(data, rx + 1, w, PX_RGB888);
+		data += w * 2;
+	}
+}
+
+// one clip row for flood fill: palette indices in framebuffer, RGB565 otherwise
+static
+void TFT_floodRow(ILI9341PyObject *self, int y, unsigned short *row) {
+	unsigned char buf[ILI9341_TFTHEIGHT * 2];
+	int i, w = self->clip_x1 - self->clip_x0 + 1;
+
+	if (self->fb != NULL) {
+		for (i=0; i<w; i++) row[i] = TFT_fbGet(self, self->clip_x0 + i, y);
+		return;
+	}
+
+	TFT_readRect(self, self->clip_x0, y, w, 1, buf);
+	for (i=0; i<w; i++) row[i] = (buf[i * 2] << 8) | buf[i * 2 + 1];
+}
+
+/*
+ * Scanline flood fill of the area connected to x, y having its color.
+ * Spans (xl, xr, y) waiting to be scanned are kept on a heap stack instead
+ * of recursing per pixel. Only the row under scan is kept, so spans
+ * popped one after another from the same row share a read, but a row is
+ * read again from the panel or framebuffer whenever the fill comes back to
+ * it. Returns -1 when out of memory.
+ */
+static
+int TFT_floodFill(ILI9341PyObject *self, int x, int y, int color) {
+	unsigned short row[ILI9341_TFTHEIGHT];
+	short *stack = NULL, *p;
+	int sp = 0, size = 0, row_y = -1, target, fill, xl, xr, a, b, i, n;
+
+	if (x < self->clip_x0 || x > self->clip_x1 || y < self->clip_y0 || y > self->clip_y1) return 0;
+
+	TFT_floodRow(self, y, row);
+	row_y = y;
+	target = row[x - self->clip_x0];
+	fill = TFT_rop(self->rop, target, color);
+	if (self->fb != NULL) fill &= (1 << self->fb_bpp) - 1;
+	else fill &= 0xffff;
+	if (fill == target) return 0;
+
+	xl = xr = x;
+	for (;;) {
+		for (i=xl; i<=xr; i++) {
+			if (row[i - self->clip_x0] != target) continue;
+
+			for (a=i; a>self->clip_x0 && row[a - 1 - self->clip_x0] == target; a--);
+			for (b=i; b<self->clip_x1 && row[b + 1 - self->clip_x0] == target; b++);
+
+			TFT_fillRect(self, a, y, b - a + 1, 1, color);
+			for (n=a; n<=b; n++) row[n - self->clip_x0] = fill;
+
+			if (sp + 6 > size) {
+				size = size ? size * 2 : 192;
+				if ((p = realloc(stack, size * sizeof(short))) == NULL) {
+					free(stack);
+					return -1;
+				}
+				stack = p;
+			}
+			if (y > self->clip_y0) {
+				stack[sp++] = a;
+				stack[sp++] = b;
+				stack[sp++] = y - 1;
+			}
+			if (y < self->clip_y1) {
+				stack[sp++] = a;
+				stack[sp++] = b;
+				stack[sp++] = y + 1;
+			}
+			i = b + 1;
+		}
+
+		if (sp == 0) break;
+		y = stack[--sp];
+		xr = stack[--sp];
+		xl = stack[--sp];
+		if (y != row_y) {
+			TFT_floodRow(self, y, row);
+			row_y = y;
+		}
+	}
+
+	free(stack);
+	return 0;
+}
+
+// Bresenham's algorithm - thx wikpedia
+static
+void TFT_line(ILI9341PyObject *self, int x0, int y0, int x1, int y1, int color) {
+	int steep = abs(y1 - y0) > abs(x1 - x0);
+	int dx, dy, err, ystep;
+
+	if (x0 == x1 || y0 == y1) {
+		if (x0 > x1) swap(&x0, &x1);
+		if (y0 > y1) swap(&y0, &y1);
+		TFT_fillRect(self, x0, y0, x1 - x0 + 1, y1 - y0 + 1, color);
+		return;
+	}
+
+	if (steep) {
+		swap(&x0, &y0);
+		swap(&x1, &y1);
+	}
+
+	if (x0 > x1) {
+		swap(&x0, &x1);
+		swap(&y0, &y1);
+	}
+
+	dx = x1 - x0;
+	dy = abs(y1 - y0);
+	err = dx / 2;
+	ystep = (y0 < y1) ? 1 : -1;
+
+	for (; x0<=x1; x0++) {
+		if (steep) {
+			TFT_setPixel(self, y0, x0, color);
+		} else {
+			TFT_setPixel(self, x0, y0, color);
+		}
+		err -= dy;
+		if (err < 0) {
+			y0 += ystep;
+			err += dx;
+		}
+	}
+}
+
+static
+void TFT_rect(ILI9341PyObject *self, int x, int y, int w, int h, int color) {
+	// edges must not overlap, xor would clear the corners
+	if (w <= 2 || h <= 2) {
+		TFT_fillRect(self, x, y, w, h, color);
+		return;
+	}
+
+	TFT_fillRect(self, x, y, w, 1, color);
+	TFT_fillRect(self, x, y + h - 1, w, 1, color);
+	TFT_fillRect(self, x, y + 1, 1, h - 2, color);
+	TFT_fillRect(self, x + w - 1, y + 1, 1, h - 2, color);
+}
+
+static
+tft_font *TFT_fontLoad(const unsigned char *data) {
+	tft_font *f;
+	tft_range *r;
+	unsigned char *width;
+	unsigned int *offset;
+	int i, n = data[FONT_CHAR_COUNT], fixed, pos;
+
+	if ((f = malloc(sizeof(tft_font) + sizeof(tft_range) + n * (sizeof(unsigned int) + 1))) == NULL) {
+		return NULL;
+	}
+
+	r = (tft_range *)(f + 1);
+	offset = (unsigned int *)(r + 1);
+	width = (unsigned char *)(offset + n);
+
+	r->first = data[FONT_FIRST_CHAR];
+	r->count = n;
+	r->index = 0;
+
+	f->data = data;
+	f->height = data[FONT_HEIGHT];
+	f->bytes = (f->height + 7) / 8;
+	f->ranges = 1;
+	f->range = r;
+	f->size = 0;
+	f->offset = offset;
+	f->width = width;
+
+	// zero length is flag indicating fixed width font (array does not contain width data entries)
+	fixed = data[FONT_LENGTH] == 0 && data[FONT_LENGTH + 1] == 0;
+	pos = FONT_WIDTH_TABLE + (fixed ? 0 : n);
+
+	for (i=0; i<n; i++) {
+		width[i] = fixed ? data[FONT_FIXED_WIDTH] : data[FONT_WIDTH_TABLE + i];
+		offset[i] = pos;
+		pos += width[i] * f->bytes;
+	}
+
+	TFT_fontSpace(f);
+
+	return f;
+}
+
+// little-endian numbers of font file
+static inline
+unsigned int TFT_le16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline
+unsigned int TFT_le32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// map font file read-only and check its tables, sets python error on failure
+static
+tft_font *TFT_fontMap(const char *path) {
+	int fd;
+	off_t size;
+	unsigned long long tables, fsize;
+	unsigned int height, ranges, glyphs, i, j;
+	const unsigned char *p, *width;
+	const unsigned int *offset;
+	const tft_range *r;
+	tft_font *f;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+		return NULL;
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	p = size >= FONT_HEADER ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		PyErr_Format(PyExc_ValueError, "can't map font %s", path);
+		return NULL;
+	}
+
+	// size is positive once mapped, bounds are checked unsigned
+	fsize = size;
+	height = TFT_le16(p + 4);
+	ranges = TFT_le16(p + 6);
+	glyphs = TFT_le32(p + 8);
+	tables = FONT_HEADER + ranges * sizeof(tft_range) + glyphs * (sizeof(unsigned int) + 1ULL);
+
+	if (memcmp(p, FONT_MAGIC, 4) != 0 || height == 0 || height > 255 || tables > fsize) {
+		goto invalid;
+	}
+
+	r = (const tft_range *)(p + FONT_HEADER);
+	offset = (const unsigned int *)(r + ranges);
+	width = (const unsigned char *)(offset + glyphs);
+
+	for (i=0; i<ranges; i++) {
+		if ((unsigned long long)r[i].index + r[i].count > glyphs ||
+		    (i > 0 && r[i].first < (unsigned long long)r[i - 1].first + r[i - 1].count)) {
+			goto invalid;
+		}
+	}
+
+	for (j=0; j<glyphs; j++) {
+		if (offset[j] + (unsigned long long)width[j] * ((height + 7) / 8) > fsize) {
+			goto invalid;
+		}
+	}
+
+	if ((f = malloc(sizeof(tft_font))) == NULL) {
+		munmap((void *)p, size);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	f->data = p;
+	f->height = height;
+	f->bytes = (height + 7) / 8;
+	f->ranges = ranges;
+	f->range = r;
+	f->offset = offset;
+	f->width = width;
+	f->size = size;
+	TFT_fontSpace(f);
+
+	return f;
+
+invalid:
+	munmap((void *)p, size);
+	PyErr_Format(PyExc_ValueError, "invalid font file %s", path);
+	return NULL;
+}
+
+/*
+ * Byte and bit holding glyph row r in each column. Columns are stored as
+ * bytes LSB at top, last byte is aligned to the glyph bottom, so with
+ * heights that are not a multiple of 8 its top bits repeat the byte above.
+ * Fonts lower than 8 pixels are aligned that way too and paint height + 1
+ * rows.
+ */
+static inline
+void TFT_glyphRow(tft_font *f, int r, int *byte, int *bit) {
+	if (f->height < 8) {
+		*byte = 0;
+		*bit = r + 7 - f->height;
+	} else if (f->bytes > 1 && r >= (f->bytes - 1) * 8) {
+		*byte = f->bytes - 1;
+		*bit = r - (f->height - 8);
+	} else {
+		*byte = r / 8;
+		*bit = r % 8;
+	}
+}
+
+// column data of glyph and its width, NULL when font does not have it
+static inline
+const unsigned char *TFT_glyph(tft_font *f, int ch, int *width) {
+	int lo = 0, hi = f->ranges - 1, m, i;
+	const tft_range *r;
+
+	// binary search of range holding ch
+	while (lo <= hi) {
+		m = (lo + hi) / 2;
+		r = &f->range[m];
+
+		if ((unsigned int)ch < r->first) {
+			hi = m - 1;
+		} else if ((unsigned int)ch - r->first >= r->count) {
+			lo = m + 1;
+		} else {
+			i = r->index + ch - r->first;
+			*width = f->width[i];
+			return f->data + f->offset[i];
+		}
+	}
+
+	return NULL;
+}
+
+static
+void TFT_fontSpace(tft_font *f) {
+	int width;
+
+	f->space = TFT_glyph(f, 'n', &width) != NULL ? width : 0;
+}
+
+static tft_font_entry fonts_builtin[sizeof(fonts_table) / sizeof(fonts_table[0])];
+static tft_font_entry *fonts_hash[FONT_BUCKETS];
+
+static
+unsigned int TFT_fontHash(const char *name) {
+	return TFT_cacheHash((const unsigned char *)name, strlen(name)) % FONT_BUCKETS;
+}
+
+static
+tft_font_entry *TFT_fontEntry(const char *name) {
+	tft_font_entry *e;
+	unsigned int h;
+	int i;
+
+	if (fonts_builtin[0].name == NULL) {
+		for (i=0; fonts_table[i].name != NULL; i++) {
+			e = &fonts_builtin[i];
+			e->name = (const char *)fonts_table[i].name;
+			e->builtin = fonts_table[i].data;
+			h = TFT_fontHash(e->name);
+			e->next = fonts_hash[h];
+			fonts_hash[h] = e;
+		}
+	}
+
+	for (e = fonts_hash[TFT_fontHash(name)]; e != NULL; e = e->next) {
+		if (strcmp(e->name, name) == 0) return e;
+	}
+
+	return NULL;
+}
+
+static
+tft_font *TFT_findFont(const char *name) {
+	tft_font_entry *e;
+
+	if ((e = TFT_fontEntry(name)) == NULL) {
+		return NULL;
+	}
+
+	if (e->font == NULL) {
+		e->font = TFT_fontLoad(e->builtin);
+	}
+
+	return e->font;
+}
+
+// add loaded font under name, -1 if name is taken or out of memory
+static
+int TFT_fontRegister(const char *name, tft_font *font) {
+	tft_font_entry *e;
+	unsigned int h;
+
+	if (TFT_fontEntry(name) != NULL || (e = malloc(sizeof(tft_font_entry) + strlen(name) + 1)) == NULL) {
+		return -1;
+	}
+
+	e->name = strcpy((char *)(e + 1), name);
+	e->builtin = NULL;
+	e->font = font;
+
+	h = TFT_fontHash(e->name);
+	e->next = fonts_hash[h];
+	fonts_hash[h] = e;
+
+	return 0;
+}
+
+static
+int TFT_rgb2color(ILI9341PyObject *self, int R, int G, int B) {
+	int rgb;
+
+	/*rgb = R & 0x1F;
+	rgb <<= 6;
+	rgb |= G & 0x3F;
+	rgb <<= 5;
+	rgb |= B & 0x1F;*/
+	
+	rgb = ((R & 0xF8) << 8) | ((G & 0xFC) << 3) | (B >> 3);
+
+	return rgb;
+}
+
+static
+void TFT_setPixel(ILI9341PyObject *self, int poX, int poY, int color) {
+	if (poX < self->clip_x0 || poX > self->clip_x1 || poY < self->clip_y0 || poY > self->clip_y1) return;
+
+	unsigned char px[2];
+
+	if (self->fb != NULL) {
+		TFT_fbSet(self, poX, poY, TFT_rop(self->rop, TFT_fbGet(self, poX, poY), color));
+		TFT_fbDirty(self, poX, poY, poX, poY);
+		return;
+	}
+
+	if (self->rop != TFT_ROP_COPY) {
+		px[0] = color >> 8;
+		px[1] = color & 0xff;
+		TFT_setWindow(self, poX, poY, poX, poY);
+		TFT_sendBuffer(self, px, 2);
+		return;
+	}
+
+	TFT_setXY(self, poX, poY);
+	TFT_sendWord(self, color);
+}
+
+// FNV-1a
+static
+unsigned int TFT_cacheHash(const unsigned char *key, int len) {
+	unsigned int h = 2166136261u;
+
+	while (len-- > 0) {
+		h = (h ^ *key++) * 16777619u;
+	}
+
+	return h;
+}
+
+// entry for key moved to front of LRU list, NULL if not cached
+static
+tft_cache_entry *TFT_cacheFind(tft_cache *c, const void *key, int len) {
+	unsigned int h = TFT_cacheHash(key, len);
+	tft_cache_entry *e;
+
+	for (e=c->hash[h % TFT_CACHE_BUCKETS]; e!=NULL; e=e->hnext) {
+		if (e->hash == h && e->key_len == len && memcmp(e->key, key, len) == 0) break;
+	}
+
+	if (e != NULL && e != c->head) {
+		e->prev->next = e->next;
+		if (e->next != NULL) e->next->prev = e->prev;
+		else c->tail = e->prev;
+
+		e->prev = NULL;
+		e->next = c->head;
+		c->head->prev = e;
+		c->head = e;
+	}
+
+	return e;
+}
+
+/*
+ * New entry with room for px_size bytes of pixels, NULL when it does not
+ * fit the budget or memory. Nothing is evicted here, so entries in use
+ * stay valid until TFT_cacheTrim is called after drawing.
+ */
+static
+tft_cache_entry *TFT_cacheAdd(tft_cache *c, const void *key, int len, int px_size) {
+	int size = sizeof(tft_cache_entry) + len + px_size;
+	tft_cache_entry *e;
+
+	if (size > c->budget || (e = malloc(size)) == NULL) {
+		return NULL;
+	}
+
+	e->hash = TFT_cacheHash(key, len);
+	e->size = size;
+	e->key_len = len;
+	e->key = (unsigned char *)(e + 1);
+	e->px = e->key + len;
+	memcpy(e->key, key, len);
+
+	e->hnext = c->hash[e->hash % TFT_CACHE_BUCKETS];
+	c->hash[e->hash % TFT_CACHE_BUCKETS] = e;
+
+	e->prev = NULL;
+	e->next = c->head;
+	if (c->head != NULL) c->head->prev = e;
+	else c->tail = e;
+	c->head = e;
+
+	c->bytes += size;
+
+	return e;
+}
+
+// drop least recently used entries until cache fits budget
+static
+void TFT_cacheTrim(tft_cache *c, int budget) {
+	tft_cache_entry *e, **h;
+
+	while (c->tail != NULL && c->bytes > budget) {
+		e = c->tail;
+
+		h = &c->hash[e->hash % TFT_CACHE_BUCKETS];
+		while (*h != e) h = &(*h)->hnext;
+		*h = e->hnext;
+
+		c->tail = e->prev;
+		if (e->prev != NULL) e->prev->next = NULL;
+		else c->head = NULL;
+
+		c->bytes -= e->size;
+		free(e);
+	}
+}
+
+// text cache key, code points follow it. Glyphs are keyed by ch alone
+typedef struct {
+	tft_font *font;
+	int ch, fg, bg, spacing;
+	int rows;		/* strip height, fallback glyphs differ by line */
+} tft_text_key;
+
+// glyph rows painted, fonts lower than 8 pixels get a blank one
+static inline
+int TFT_fontRows(tft_font *f) {
+	return f->height < 8 ? f->height + 1 : f->height;
+}
+
+// expanded glyph of c, rows high in current colors
+static
+tft_cache_entry *TFT_glyphCached(ILI9341PyObject *self, const tft_char *c, int rows) {
+	tft_text_key key;
+	tft_cache_entry *e;
+	unsigned char *p;
+	const unsigned char *glyph;
+	int j, k, w = c->width, byte, bit, color;
+
+	memset(&key, 0, sizeof(key));
+	key.font = c->font;
+	key.ch = c->ch;
+	key.fg = self->color;
+	key.bg = self->bg_color;
+	key.rows = rows;
+
+	if ((e = TFT_cacheFind(&self->glyph_cache, &key, sizeof(key))) != NULL) {
+		return e;
+	}
+
+	if ((e = TFT_cacheAdd(&self->glyph_cache, &key, sizeof(key), w * rows * 2)) == NULL) {
+		return NULL;
+	}
+
+	for (k=0, p=e->px; k<rows; k++) {
+		glyph = k < TFT_fontRows(c->font) ? c->glyph : NULL;
+		TFT_glyphRow(c->font, k, &byte, &bit);
+		for (j=0; j<w; j++) {
+			color = (glyph != NULL && ((glyph[j + byte * w] >> bit) & 1)) ? key.fg : key.bg;
+			*p++ = color >> 8;
+			*p++ = color & 0xff;
+		}
+	}
+
+	return e;
+}
+
+// append to pending transfer, flushing full buffers
+static
+void TFT_txCopy(ILI9341PyObject *self, const unsigned char *data, int len) {
+	int n;
+
+	while (len > 0) {
+		if (self->tx_len == SPI_TX_BUFSIZE) {
+			TFT_flush(self);
+		}
+		n = SPI_TX_BUFSIZE - self->tx_len;
+		if (n > len) n = len;
+
+		memcpy(self->tx_buf + self->tx_len, data, n);
+		self->tx_len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+/*
+ * Row r of text strip starting at x, pixels x0 to x1 as big-endian RGB565
+ * (palette indices in framebuffer). Glyph cells are followed by spacing in
+ * bg_color, except for the last one. Glyphs found in cached are copied.
+ */
+static
+void TFT_textRow(ILI9341PyObject *self, const tft_char *str, int n, int x, int spacing, int r, int x0, int x1, tft_cache_entry **cached, unsigned char *out) {
+	int i, j, w, adv, p, e, byte, bit, color;
+	const unsigned char *glyph;
+
+	for (i=0, p=x; i<n && p<=x1; i++, p+=adv) {
+		w = str[i].width;
+		adv = w + (i < n - 1 ? spacing : 0);
+		if (p + adv <= x0) continue;
+
+		// fallback glyphs keep their own height, rows below are background
+		glyph = r < TFT_fontRows(str[i].font) ? str[i].glyph : NULL;
+		TFT_glyphRow(str[i].font, r, &byte, &bit);
+
+		j = p < x0 ? x0 - p : 0;
+		if (cached != NULL && cached[i] != NULL && j < w) {
+			e = w < x1 - p + 1 ? w : x1 - p + 1;
+			memcpy(out, cached[i]->px + (r * w + j) * 2, (e - j) * 2);
+			out += (e - j) * 2;
+			j = e;
+		}
+
+		for (; j < adv && p + j <= x1; j++) {
+			color = (j < w && glyph != NULL && ((glyph[j + byte * w] >> bit) & 1)) ? self->color : self->bg_color;
+			*out++ = color >> 8;
+			*out++ = color & 0xff;
+		}
+	}
+}
+
+/*
+ * Line of n chars at x, y rasterized as one strip: glyph cells and the
+ * spacing between them, painted with bg_color like glyph background, go
+ * to the panel in a single window built row by row. Glyphs come from the
+ * glyph cache when it is enabled, so row pieces are plain copies. With
+ * cache set the whole strip is kept in text cache and later drawn as one
+ * blit. Framebuffer colors are palette indices, there rows are drawn as
+ * runs. Returns strip width.
+ */
+static
+int TFT_text(ILI9341PyObject *self, const tft_char *str, int n, int x, int y, int spacing, int cache) {
+	tft_font *font = self->font;
+	int gh = TFT_fontRows(font);
+	int i, j, k, m, w, adv, p, c, x0, y0, x1, y1, rx0, rx1, total = 0;
+	unsigned char key[sizeof(tft_text_key) + 256 * sizeof(int)], row[ILI9341_TFTHEIGHT * 2];
+	tft_cache_entry *cached[ILI9341_TFTHEIGHT], *e = NULL;
+	tft_text_key *tk = (tft_text_key *)key;
+	int *codes = (int *)(key + sizeof(tft_text_key));
+
+	// overlapping glyphs, later ones overwrite earlier as they used to
+	if (spacing < 0 && n > 1) {
+		for (i=0; i<n; i++) {
+			w = TFT_text(self, str + i, 1, x + total, y, 0, 0) + spacing;
+			total += w;
+		}
+		return total - spacing;
+	}
+
+	total = TFT_textWidth(str, n, spacing);
+
+	x0 = x > self->clip_x0 ? x : self->clip_x0;
+	y0 = y > self->clip_y0 ? y : self->clip_y0;
+	x1 = x + total - 1 < self->clip_x1 ? x + total - 1 : self->clip_x1;
+	y1 = y + gh - 1 < self->clip_y1 ? y + gh - 1 : self->clip_y1;
+	if (x0 > x1 || y0 > y1) return total;
+
+	rx0 = x0;
+	rx1 = x1;
+
+	if (cache && self->fb == NULL && n > 1 && n <= 256 && self->text_cache.budget > 0) {
+		memset(tk, 0, sizeof(tft_text_key));
+		tk->font = font;
+		tk->ch = n;
+		tk->fg = self->color;
+		tk->bg = self->bg_color;
+		tk->spacing = spacing;
+		tk->rows = gh;
+		for (i=0; i<n; i++) codes[i] = str[i].ch;
+
+		if ((e = TFT_cacheFind(&self->text_cache, key, sizeof(tft_text_key) + n * sizeof(int))) != NULL) {
+			TFT_blit(self, x, y, total, gh, e->px);
+			return total;
+		}
+
+		// render whole strip, parts clipped now may be visible next time
+		if ((e = TFT_cacheAdd(&self->text_cache, key, sizeof(tft_text_key) + n * sizeof(int), total * gh * 2)) != NULL) {
+			rx0 = x;
+			rx1 = x + total - 1;
+		}
+	}
+
+	for (i=0, p=x; i<n && i<ILI9341_TFTHEIGHT; i++, p+=adv) {
+		w = str[i].width;
+		adv = w + (i < n - 1 ? spacing : 0);
+		cached[i] = (self->fb == NULL && self->glyph_cache.budget > 0 && w > 0 && p + w > rx0 && p <= rx1) ? TFT_glyphCached(self, &str[i], gh) : NULL;
+	}
+
+	if (e != NULL) {
+		for (k=0; k<gh; k++) {
+			TFT_textRow(self, str, n, x, spacing, k, rx0, rx1, cached, e->px + k * total * 2);
+		}
+		TFT_blit(self, x, y, total, gh, e->px);
+	} else if (self->fb == NULL) {
+		TFT_setWindow(self, x0, y0, x1, y1);
+		for (k=y0; k<=y1; k++) {
+			TFT_textRow(self, str, n, x, spacing, k - y, x0, x1, n <= ILI9341_TFTHEIGHT ? cached : NULL, row);
+			TFT_txCopy(self, row, (x1 - x0 + 1) * 2);
+		}
+		TFT_flush(self);
+	} else {
+		for (k=y0; k<=y1; k++) {
+			TFT_textRow(self, str, n, x, spacing, k - y, x0, x1, NULL, row);
+			for (j=0; j<=x1-x0; j=m) {
+				c = (row[j * 2] << 8) | row[j * 2 + 1];
+				for (m=j+1; m<=x1-x0 && ((row[m * 2] << 8) | row[m * 2 + 1]) == c; m++);
+				TFT_fillRect(self, x0 + j, k, m - j, 1, c);
+			}
+		}
+	}
+
+	TFT_cacheTrim(&self->glyph_cache, self->glyph_cache.budget);
+	TFT_cacheTrim(&self->text_cache, self->text_cache.budget);
+
+	return total;
+}
+
+// rows r0 to r0 + 63 of glyph column j as bit mask, bit 0 is row r0
+static
+unsigned long long TFT_glyphColumn(tft_font *f, const unsigned char *glyph, int w, int j, int r0) {
+	int gh = f->height < 8 ? f->height + 1 : f->height, i = f->bytes - 1, r, byte, bit;
+	unsigned long long m = 0;
+
+	if (f->height < 8) return glyph[j] >> (7 - f->height);
+
+	if (r0 == 0 && gh <= 64) {
+		if (i == 0) return glyph[j];
+
+		for (r=0; r<i; r++) m |= (unsigned long long)glyph[j + r * w] << (r * 8);
+		// last byte is aligned to glyph bottom, drop rows of byte above
+		return m | (unsigned long long)(glyph[j + i * w] >> (f->bytes * 8 - f->height)) << (i * 8);
+	}
+
+	for (r=r0; r<gh && r<r0+64; r++) {
+		TFT_glyphRow(f, r, &byte, &bit);
+		if ((glyph[j + byte * w] >> bit) & 1) m |= 1ULL << (r - r0);
+	}
+
+	return m;
+}
+
+/*
+ * Only set pixels of glyph, as runs found in each column with count
+ * trailing zeros and drawn as one window each. Column j row r lands on
+ * x + j * ax + r * dx, y + j * ay + r * dy, so rotated glyphs work too.
+ */
+static
+void TFT_glyphRuns(ILI9341PyObject *self, tft_font *font, const unsigned char *glyph, int w, int x, int y, int ax, int ay, int dx, int dy) {
+	int gh = TFT_fontRows(font);
+	int j, r, r0, s, n, xa, ya, xb, yb;
+	unsigned long long m;
+
+	for (j=0; j<w; j++) {
+		for (r0=0; r0<gh; r0+=64) {
+			m = TFT_glyphColumn(font, glyph, w, j, r0);
+			r = r0;
+
+			while (m != 0) {
+				s = __builtin_ctzll(m);
+				m >>= s;
+				r += s;
+				n = ~m != 0 ? __builtin_ctzll(~m) : 64;
+
+				xa = x + j * ax + r * dx;
+				ya = y + j * ay + r * dy;
+				xb = xa + (n - 1) * dx;
+				yb = ya + (n - 1) * dy;
+				TFT_fillRect(self, xa < xb ? xa : xb, ya < yb ? ya : yb, abs(xb - xa) + 1, abs(yb - ya) + 1, self->color);
+
+				m = n < 64 ? m >> n : 0;
+				r += n;
+			}
+		}
+	}
+}
+
+// transparent line of text, glyph background and spacing are left alone
+static
+int TFT_textRuns(ILI9341PyObject *self, const tft_char *str, int n, int x, int y, int spacing) {
+	int i, w, p = x;
+
+	for (i=0; i<n; i++) {
+		w = str[i].width;
+		if (str[i].glyph != NULL && p + w > self->clip_x0 && p <= self->clip_x1) {
+			TFT_glyphRuns(self, str[i].font, str[i].glyph, w, p, y, 1, 0, 0, 1);
+		}
+		p += w + spacing;
+	}
+
+	return p - x - spacing;
+}
+
+static
+int TFT_char(ILI9341PyObject *self, unsigned char ch) {
+	tft_char c;
+
+	TFT_charGlyph(self, ch, &c);
+
+	return TFT_text(self, &c, 1, self->cursor_x, self->cursor_y, 0, 0);
+}
+
+static
+void TFT_setMadctl(ILI9341PyObject *self, int madctl) {
+	if (self->madctl_cur == madctl) return;
+
+	TFT_sendCMD(self, ILI9341_MADCTL);
+	TFT_sendDATA(self, madctl);
+	self->madctl_cur = madctl;
+}
+
+// panel memory direction of a logical step under madctl, x is column
+static
+void TFT_madctlStep(int madctl, int dx, int dy, int *px, int *py) {
+	*px = (madctl & MADCTL_MV) ? dy : dx;
+	*py = (madctl & MADCTL_MV) ? dx : dy;
+	if (madctl & MADCTL_MX) *px = -*px;
+	if (madctl & MADCTL_MY) *py = -*py;
+}
+
+static
+void TFT_madctlToPanel(int madctl, int x, int y, int *px, int *py) {
+	*px = (madctl & MADCTL_MV) ? y : x;
+	*py = (madctl & MADCTL_MV) ? x : y;
+	if (madctl & MADCTL_MX) *px = ILI9341_TFTWIDTH - 1 - *px;
+	if (madctl & MADCTL_MY) *py = ILI9341_TFTHEIGHT - 1 - *py;
+}
+
+static
+void TFT_madctlFromPanel(int madctl, int px, int py, int *x, int *y) {
+	if (madctl & MADCTL_MX) px = ILI9341_TFTWIDTH - 1 - px;
+	if (madctl & MADCTL_MY) py = ILI9341_TFTHEIGHT - 1 - py;
+	*x = (madctl & MADCTL_MV) ? py : px;
+	*y = (madctl & MADCTL_MV) ? px : py;
+}
+
+/*
+ * Glyph drawn with its top towards direction - 90 degrees, so 90 runs
+ * downwards and 270 upwards. Font data is column major; MADCTL is set so
+ * that the panel address counter walks down a glyph column and then on to
+ * the next one, and each glyph is a single window.
+ */
+static
+int TFT_charDir(ILI9341PyObject *self, const tft_char *c, int direction, int transparent) {
+	int bX = self->cursor_x, bY = self->cursor_y;
+	tft_font *font = c->font;
+	int gh = TFT_fontRows(font);
+	int width = c->width, i, j, k, bit, color;
+	int ax, ay, dx, dy, x0, y0, x1, y1, px, py, qx, qy, m, cx, cy;
+	const unsigned char *glyph = c->glyph;
+	signed char col[256];
+
+	// advance and down steps in screen coordinates
+	ax = direction == 0 ? 1 : (direction == 180 ? -1 : 0);
+	ay = direction == 90 ? 1 : (direction == 270 ? -1 : 0);
+	dx = -ay;
+	dy = ax;
+
+	x0 = bX;
+	y0 = bY;
+	x1 = bX + (width - 1) * ax + (gh - 1) * dx;
+	y1 = bY + (width - 1) * ay + (gh - 1) * dy;
+	if (x0 > x1) swap(&x0, &x1);
+	if (y0 > y1) swap(&y0, &y1);
+
+	if (width == 0 || x1 < self->clip_x0 || x0 > self->clip_x1 || y1 < self->clip_y0 || y0 > self->clip_y1) {
+		return width;
+	}
+
+	if (transparent) {
+		if (glyph != NULL) TFT_glyphRuns(self, font, glyph, width, bX, bY, ax, ay, dx, dy);
+		return width;
+	}
+
+	// glyph fully visible on the panel: pick MADCTL whose columns run down
+	// the glyph and pages along the text, then window starts at glyph origin
+	m = -1;
+	if (self->fb == NULL && self->rop == TFT_ROP_COPY && x0 >= self->clip_x0 && x1 <= self->clip_x1 && y0 >= self->clip_y0 && y1 <= self->clip_y1) {
+		TFT_madctlStep(self->madctl, dx, dy, &px, &py);
+		TFT_madctlStep(self->madctl, ax, ay, &qx, &qy);
+		m = MADCTL_BGR;
+		if (px != 0) {
+			if (px < 0) m |= MADCTL_MX;
+			if (qy < 0) m |= MADCTL_MY;
+		} else {
+			m |= MADCTL_MV;
+			if (py < 0) m |= MADCTL_MY;
+			if (qx < 0) m |= MADCTL_MX;
+		}
+
+		TFT_madctlToPanel(self->madctl, bX, bY, &px, &py);
+		TFT_madctlFromPanel(m, px, py, &cx, &cy);
+
+		TFT_setMadctl(self, m);
+		TFT_setWindow(self, cx, cy, cx + gh - 1, cy + width - 1);
+	} else {
+		// clipped glyph after a rotated one goes through logical windows
+		TFT_setMadctl(self, self->madctl);
+	}
+
+	for (j = 0; j < width; j++) {
+		for (k = 0; k < gh; k++) {
+			TFT_glyphRow(font, k, &i, &bit);
+			col[k] = glyph != NULL && ((glyph[j + i * width] >> bit) & 1);
+		}
+
+		for (k = 0; k < gh; k++) {
+			color = col[k] ? self->color : self->bg_color;
+			if (m < 0) {
+				TFT_setPixel(self, bX + j * ax + k * dx, bY + j * ay + k * dy, color);
+				continue;
+			}
+
+			if (self->tx_len == SPI_TX_BUFSIZE) {
+				TFT_flush(self);
+			}
+			self->tx_buf[self->tx_len++] = color >> 8;
+			self->tx_buf[self->tx_len++] = color & 0xff;
+		}
+	}
+
+	TFT_flush(self);
+
+	return width;
+}
+
+// glyph of code point ch in current font, else in first fallback font having it
+static
+void TFT_charGlyph(ILI9341PyObject *self, int ch, tft_char *c) {
+	int i;
+
+	c->ch = ch;
+	c->font = self->font;
+	c->glyph = NULL;
+	c->width = 0;
+
+	if (ch == ' ') {
+		c->width = self->font->space;
+		return;
+	}
+
+	if ((c->glyph = TFT_glyph(self->font, ch, &c->width)) != NULL) {
+		return;
+	}
+
+	for (i=0; i<self->fallbacks; i++) {
+		if ((c->glyph = TFT_glyph(self->fallback[i], ch, &c->width)) != NULL) {
+			c->font = self->fallback[i];
+			return;
+		}
+	}
+}
+
+// next code point of UTF-8 string, bytes of malformed sequences stand for themselves
+static
+int TFT_utf8Next(const unsigned char *s, int len, int *i) {
+	int c = s[*i], n, k, ch;
+
+	if (c < 0x80) {
+		(*i)++;
+		return c;
+	}
+
+	if (c >= 0xc2 && c <= 0xdf) {
+		n = 1;
+		ch = c & 0x1f;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		n = 2;
+		ch = c & 0x0f;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		n = 3;
+		ch = c & 0x07;
+	} else {
+		n = 0;
+		ch = 0;
+	}
+
+	for (k=1; k<=n; k++) {
+		if (*i + k >= len || (s[*i + k] & 0xc0) != 0x80) {
+			n = 0;
+			break;
+		}
+		ch = (ch << 6) | (s[*i + k] & 0x3f);
+	}
+
+	// overlong forms, surrogates and code points past U+10FFFF
+	if (n == 0 || (n == 2 && ch < 0x800) || (n == 3 && (ch < 0x10000 || ch > 0x10ffff)) || (ch >= 0xd800 && ch <= 0xdfff)) {
+		(*i)++;
+		return c;
+	}
+
+	*i += n + 1;
+	return ch;
+}
+
+// decode UTF-8 string into out, which needs room for len chars
+static
+int TFT_decode(ILI9341PyObject *self, const unsigned char *str, int len, tft_char *out) {
+	int i = 0, n;
+
+	for (n=0; i<len; n++) {
+		out[n].pos = i;
+		TFT_charGlyph(self, TFT_utf8Next(str, len, &i), &out[n]);
+	}
+
+	return n;
+}
+
+// width of n chars drawn as one strip, spacing only between glyphs
+static
+int TFT_textWidth(const tft_char *str, int n, int spacing) {
+	int i, w = 0;
+
+	for (i=0; i<n; i++) {
+		w += str[i].width + (i < n - 1 ? spacing : 0);
+	}
+
+	return w;
+}
+
+/*
+ * Break str into lines no wider than w, at spaces with TFT_WRAP_WORD or
+ * at any char with TFT_WRAP_CHAR, and always at '\n'. Spaces around a
+ * wrap are dropped. Lines go down by font height plus char spacing, as in
+ * write(), while they fit in h. lines must have room for len + 1 entries.
+ */
+static
+int TFT_layout(ILI9341PyObject *self, const tft_char *str, int len, int w, int h, int align, int wrap, tft_line *lines) {
+	tft_font *font = self->font;
+	int spacing = self->char_spacing, pitch = font->height + spacing;
+	int gh = TFT_fontRows(font);
+	int i = 0, j, end, next, brk, width, n = 0;
+	tft_line *l;
+
+	while (i <= len && n * pitch + gh <= h) {
+		for (j=i, brk=-1, width=0; j<len && str[j].ch != '\n'; j++) {
+			width += str[j].width + (j > i ? spacing : 0);
+			if (wrap != TFT_WRAP_NONE && width > w && j > i) break;
+			if (str[j].ch == ' ') brk = j;
+		}
+
+		if (j < len && str[j].ch != '\n') {
+			// char j does not fit, go back to last space unless word is whole line
+			end = next = (wrap == TFT_WRAP_WORD && str[j].ch != ' ' && brk > i) ? brk : j;
+			while (next < len && str[next].ch == ' ') next++;
+		} else {
+			end = j;
+			next = j + 1;
+		}
+		while (end > i && str[end - 1].ch == ' ') end--;
+
+		l = &lines[n];
+		l->start = i;
+		l->len = end - i;
+		l->width = TFT_textWidth(str + i, end - i, spacing);
+		l->x = align == TFT_ALIGN_RIGHT ? w - l->width : (align == TFT_ALIGN_CENTER ? (w - l->width) / 2 : 0);
+		l->y = n * pitch;
+
+		n++;
+		i = next;
+	}
+
+	return n;
+}
+
+static
+void swap(int *a, int *b) {
+	int temp;
+
+	temp = *b;
+	*b   = *a;
+	*a   = temp;   
+}
+
+
+/*
+ * Sprite - RGB565 image kept in native memory with its opaque runs
+ * precomputed, so drawing only sends the visible spans.
+ */
+
+typedef struct {
+	unsigned short x, len;
+} sprite_span;
+
+typedef struct {
+	PyObject_HEAD
+
+	int w, h;
+	int opaque;				/* no transparent pixels at all */
+	unsigned char *pixels;	/* w*h big-endian RGB565 */
+
+	sprite_span *spans;		/* opaque runs, row by row */
+	int *row_spans;			/* first span of each row, h + 1 entries */
+
+	unsigned char *save;	/* background under the sprite, NULL if disabled */
+	int saved, save_x, save_y, save_w, save_h;
+} SpritePyObject;
+
+static PyMemberDef sprite_members[] = {
+	{"w", T_INT, offsetof(SpritePyObject, w), READONLY,
+		"Sprite width"},
+	{"h", T_INT, offsetof(SpritePyObject, h), READONLY,
+		"Sprite height"},
+	{NULL}  /* Sentinel */
+};
+
+// decode jpeg file to big-endian RGB565, sets python error on failure
+static
+unsigned char *jpeg_load565(const char *filename, int *w, int *h, int dither) {
+	int fd, y, ncomp;
+	px_dither d;
+	long int jpg_size, nRead;
+	unsigned char *jpg, *prgb, *out = NULL;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)filename);
+		return NULL;
+	}
+
+	jpg_size = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_SET);
+
+	if ((jpg = malloc(jpg_size)) == NULL) {
+		close(fd);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	nRead = read(fd, jpg, jpg_size);
+	close(fd);
+
+	njInit();
+	if (nRead != jpg_size || njDecode(jpg, jpg_size) != NJ_OK) {
+		PyErr_Format(PyExc_ValueError, "can't decode jpeg %s", filename);
+		goto done;
+	}
+
+	*w = njGetWidth();
+	*h = njGetHeight();
+	ncomp = njGetNComp();
+	prgb = njGetImage();
+
+	if ((out = malloc(*w * *h * 2)) == NULL || pxDitherInit(&d, dither, *w) < 0) {
+		free(out);
+		out = NULL;
+		PyErr_NoMemory();
+		goto done;
+	}
+
+	for (y=0; y<*h; y++) {
+		pxDitherRow(&d, out + y * *w * 2, prgb + y * *w * ncomp, 0, *w, ncomp == 1 ? PX_GRAY8 : PX_RGB888);
+		pxDitherNextRow(&d);
+	}
+	pxDitherDone(&d);
+
+done:
+	njDone();
+	free(jpg);
+
+	return out;
+}
+
+static
+int sprite_buildSpans(SpritePyObject *self, int key, unsigned char *mask) {
+	int x, y, start, count = 0, stride = (self->w + 7) / 8;
+	unsigned char *p;
+
+	// worst case every other pixel is transparent
+	self->spans = malloc(((self->w + 1) / 2) * self->h * sizeof(sprite_span));
+	self->row_spans = malloc((self->h + 1) * sizeof(int));
+	if (self->spans == NULL || self->row_spans == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+#define SPRITE_OPAQUE(x) (mask ? (mask[y * stride + (x) / 8] & (0x80 >> ((x) & 7))) \
+	: (key < 0 || ((p[(x) * 2] << 8) | p[(x) * 2 + 1]) != key))
+
+	self->opaque = 1;
+	for (y=0; y<self->h; y++) {
+		p = self->pixels + y * self->w * 2;
+		self->row_spans[y] = count;
+
+		for (x=0; x<self->w; ) {
+			while (x < self->w && !SPRITE_OPAQUE(x)) x++;
+			if (x == self->w) break;
+
+			start = x;
+			while (x < self->w && SPRITE_OPAQUE(x)) x++;
+
+			self->spans[count].x = start;
+			self->spans[count].len = x - start;
+			count++;
+		}
+
+		if (count - self->row_spans[y] != 1 || self->spans[count - 1].len != self->w) {
+			self->opaque = 0;
+		}
+	}
+	self->row_spans[self->h] = count;
+
+#undef SPRITE_OPAQUE
+
+	return 0;
+}
+
+static int
+sprite_init(SpritePyObject *self, PyObject *args, PyObject *kwds) {
+	unsigned char *data = NULL, *mask = NULL;
+	char *jpeg = NULL, *dither = "none";
+	int len = 0, mask_len = 0, w = 0, h = 0, key = -1, save_under = 0, mode;
+	static char *kwlist[] = {"data", "w", "h", "jpeg", "key", "mask", "save_under", "dither", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z#iizis#is", kwlist, &data, &len, &w, &h,
+			&jpeg, &key, &mask, &mask_len, &save_under, &dither))
+		return -1;
+
+	if ((mode = TFT_ditherMode(dither)) < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown dither mode %s", dither);
+		return -1;
+	}
+
+	if (self->pixels != NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "sprite is already initialized");
+		return -1;
+	}
+
+	if (jpeg != NULL) {
+		if ((self->pixels = jpeg_load565(jpeg, &w, &h, mode)) == NULL) {
+			return -1;
+		}
+	} else {
+		if (data == NULL || TFT_areaSize(w, h, 2) != len) {
+			PyErr_SetString(PyExc_ValueError, "sprite data must be w*h RGB565 pixels");
+			return -1;
+		}
+	}
+
+	// checked before pixels are kept, so a failed init can be retried
+	if (mask != NULL && mask_len != ((long long)w + 7) / 8 * h) {
+		PyErr_SetString(PyExc_ValueError, "mask must be 1 bit per pixel, rows padded to bytes");
+		if (jpeg != NULL) {
+			free(self->pixels);
+			self->pixels = NULL;
+		}
+		return -1;
+	}
+
+	if (jpeg == NULL) {
+		if ((self->pixels = malloc(len)) == NULL) {
+			PyErr_NoMemory();
+			return -1;
+		}
+		memcpy(self->pixels, data, len);
+	}
+
+	self->w = w;
+	self->h = h;
+
+	if (sprite_buildSpans(self, key, mask) < 0) {
+		return -1;
+	}
+
+	if (save_under && (self->save = malloc(w * h * 2)) == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+sprite_dealloc(SpritePyObject *self) {
+	free(self->pixels);
+	free(self->spans);
+	free(self->row_spans);
+	free(self->save);
+
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyTypeObject SpriteObjectType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size        */
+	"Sprite",		/* tp_name        */
+	sizeof(SpritePyObject),		/* tp_basicsize   */
+	0,				/* tp_itemsize    */
+	(destructor)sprite_dealloc,	/* tp_dealloc     */
+	0,				/* tp_print       */
+	0,				/* tp_getattr     */
+	0,				/* tp_setattr     */
+	0,				/* tp_compare     */
+	0,				/* tp_repr        */
+	0,				/* tp_as_number   */
+	0,				/* tp_as_sequence */
+	0,				/* tp_as_mapping  */
+	0,				/* tp_hash        */
+	0,				/* tp_call        */
+	0,				/* tp_str         */
+	0,				/* tp_getattro    */
+	0,				/* tp_setattro    */
+	0,				/* tp_as_buffer   */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags       */
+	"Sprite(data=None, w=0, h=0, jpeg=None, key=-1, mask=None, save_under=0, dither='none') -> sprite\n\n"
+	"Return a new sprite from big-endian RGB565 data or jpeg file. Pixels equal to key color or\n"
+	"with zero mask bit are transparent. With save_under background is kept for hide_sprite().\n",	/* tp_doc         */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	0,				/* tp_methods        */
+	sprite_members,	/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)sprite_init,		/* tp_init           */
+};
+
+static
+void TFT_restoreSprite(ILI9341PyObject *self, SpritePyObject *s) {
+	if (s->saved) {
+		TFT_blit(self, s->save_x, s->save_y, s->save_w, s->save_h, s->save);
+		s->saved = 0;
+	}
+}
+
+static
+void TFT_drawSprite(ILI9341PyObject *self, SpritePyObject *s, int x, int y) {
+	int i, j, k;
+	sprite_span *sp;
+
+	if (s->save != NULL) {
+		// moving sprite, put back what was under the old position first
+		TFT_restoreSprite(self, s);
+
+		s->save_x = x;
+		s->save_y = y;
+		s->save_w = s->w;
+		s->save_h = s->h;
+		if (TFT_clipRect(self, &s->save_x, &s->save_y, &s->save_w, &s->save_h)) {
+			TFT_readRect(self, s->save_x, s->save_y, s->save_w, s->save_h, s->save);
+			s->saved = 1;
+		}
+	}
+
+	if (s->opaque) {
+		TFT_blit(self, x, y, s->w, s->h, s->pixels);
+		return;
+	}
+
+	for (j=0; j<s->h; ) {
+		sp = &s->spans[s->row_spans[j]];
+
+		// batch consecutive fully opaque rows into one window
+		for (k=j; k<s->h; k++) {
+			if (s->row_spans[k + 1] - s->row_spans[k] != 1 || s->spans[s->row_spans[k]].len != s->w) break;
+		}
+
+		if (k > j) {
+			TFT_blit(self, x, y + j, s->w, k - j, s->pixels + j * s->w * 2);
+			j = k;
+			continue;
+		}
+
+		for (i=s->row_spans[j]; i<s->row_spans[j + 1]; i++, sp++) {
+			TFT_blit(self, x + sp->x, y + j, sp->len, 1, s->pixels + (j * s->w + sp->x) * 2);
+		}
+		j++;
+	}
+}
+
+static PyObject *
+ili9341_drawSprite(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	PyObject *sprite;
+	int x = self->cursor_x, y = self->cursor_y;
+	static char *kwlist[] = {"sprite", "x", "y", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|ii", kwlist, &SpriteObjectType, &sprite, &x, &y)) {
+		return NULL;
+	}
+
+	if (((SpritePyObject *)sprite)->pixels == NULL) {
+		PyErr_SetString(PyExc_ValueError, "sprite is not initialized");
+		return NULL;
+	}
+
+	TFT_drawSprite(self, (SpritePyObject *)sprite, x, y);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+ili9341_hideSprite(ILI9341PyObject *self, PyObject *args) {
+	PyObject *sprite;
+
+	if (!PyArg_ParseTuple(args, "O!", &SpriteObjectType, &sprite)) {
+		return NULL;
+	}
+
+	TFT_restoreSprite(self, (SpritePyObject *)sprite);
+
+	Py_RETURN_NONE;
+}
+
+// sine in Q14 of angle in 1/256 degrees, linear between table entries
+static
+int TFT_sinFine(int a) {
+	int s0 = TFT_sin(a >> 8), s1 = TFT_sin((a >> 8) + 1);
+
+	return s0 + (((s1 - s0) * (a & 0xff)) >> 8);
+}
+
+// narrow [lo, hi] to k where 0 <= base + step * k <= lim
+static
+void TFT_spanLimit(long long base, long long step, long long lim, long long *lo, long long *hi) {
+	long long a, b;
+
+	if (step == 0) {
+		if (base < 0 || base > lim) *lo = *hi + 1;
+		return;
+	}
+
+	if (step > 0) {
+		a = -TFT_divFloor(base, step);
+		b = TFT_divFloor(lim - base, step);
+	} else {
+		a = -TFT_divFloor(lim - base, -step);
+		b = TFT_divFloor(base, -step);
+	}
+
+	if (*lo < a) *lo = a;
+	if (*hi > b) *hi = b;
+}
+
+static inline
+int TFT_spriteOpaqueAt(SpritePyObject *s, unsigned char *mask, int i, int j) {
+	return mask == NULL || (mask[(j * s->w + i) >> 3] & (0x80 >> ((j * s->w + i) & 7)));
+}
+
+// bilinear RGB565 sample at 16.16 position, falls back to nearest pixel
+// next to transparent ones so key color does not bleed into edges
+static
+int TFT_spriteSample(SpritePyObject *s, unsigned char *mask, int u, int v) {
+	int i0, j0, i1, j1, fx, fy, w00, w10, w01, w11, c00, c10, c01, c11, r, g, b;
+	unsigned char *p = s->pixels;
+
+	u -= 0x8000;
+	v -= 0x8000;
+	i0 = u >> 16;
+	j0 = v >> 16;
+	fx = (u >> 8) & 0xff;
+	fy = (v >> 8) & 0xff;
+
+	i1 = i0 + 1 < s->w ? i0 + 1 : s->w - 1;
+	j1 = j0 + 1 < s->h ? j0 + 1 : s->h - 1;
+	if (i0 < 0) i0 = 0;
+	if (j0 < 0) j0 = 0;
+
+	c00 = (p[(j0 * s->w + i0) * 2] << 8) | p[(j0 * s->w + i0) * 2 + 1];
+	c10 = (p[(j0 * s->w + i1) * 2] << 8) | p[(j0 * s->w + i1) * 2 + 1];
+	c01 = (p[(j1 * s->w + i0) * 2] << 8) | p[(j1 * s->w + i0) * 2 + 1];
+	c11 = (p[(j1 * s->w + i1) * 2] << 8) | p[(j1 * s->w + i1) * 2 + 1];
+
+	if (mask != NULL && !(TFT_spriteOpaqueAt(s, mask, i0, j0) && TFT_spriteOpaqueAt(s, mask, i1, j0)
+			&& TFT_spriteOpaqueAt(s, mask, i0, j1) && TFT_spriteOpaqueAt(s, mask, i1, j1))) {
+		i0 = (u + 0x8000) >> 16;
+		j0 = (v + 0x8000) >> 16;
+		return (p[(j0 * s->w + i0) * 2] << 8) | p[(j0 * s->w + i0) * 2 + 1];
+	}
+
+	w00 = (256 - fx) * (256 - fy);
+	w10 = fx * (256 - fy);
+	w01 = (256 - fx) * fy;
+	w11 = fx * fy;
+
+#define SAMPLE_MIX(shift, bits) \
+	(((((c00 >> shift) & bits) * w00 + ((c10 >> shift) & bits) * w10 \
+	+ ((c01 >> shift) & bits) * w01 + ((c11 >> shift) & bits) * w11) + 0x8000) >> 16)
+
+	r = SAMPLE_MIX(11, 0x1f);
+	g = SAMPLE_MIX(5, 0x3f);
+	b = SAMPLE_MIX(0, 0x1f);
+
+#undef SAMPLE_MIX
+
+	return (r << 11) | (g << 5) | b;
+}
+
+/*
+ * Rotate by angle (1/256 degrees, clockwise) and scale (16.16) around pivot
+ * (16.16 sprite coordinates), which lands on x, y. Each destination pixel
+ * center is mapped back to the sprite by a 16.16 2x3 matrix; the range of
+ * each row that falls inside the sprite is solved for up front, so the
+ * inner loop only steps u, v and reads pixels.
+ */
+static
+void TFT_blitTransformed(ILI9341PyObject *self, SpritePyObject *s, int x, int y,
+		int angle, int scale, int pu, int pv, int bilinear) {
+	unsigned char line[ILI9341_TFTHEIGHT * 2], on[ILI9341_TFTHEIGHT], *mask = NULL, *p;
+	int sn = TFT_sinFine(angle), cs = TFT_sinFine(angle + 90 * 256);
+	long long a, b, u0, v0, lo, hi;
+	int X, Y, u, v, i, k, n, c, sp;
+
+	if (scale <= 0) return;
+
+	// matrix is [a b; -b a] plus translation, per destination pixel
+	a = ((long long)cs << 18) / scale;
+	b = ((long long)sn << 18) / scale;
+
+	if (!s->opaque) {
+		if ((mask = calloc((s->w * s->h + 7) / 8, 1)) == NULL) return;
+		for (Y=0; Y<s->h; Y++) {
+			for (sp=s->row_spans[Y]; sp<s->row_spans[Y + 1]; sp++) {
+				for (i=s->spans[sp].x; i<s->spans[sp].x + s->spans[sp].len; i++) {
+					mask[(Y * s->w + i) >> 3] |= 0x80 >> ((Y * s->w + i) & 7);
+				}
+			}
+		}
+	}
+
+	for (Y=self->clip_y0; Y<=self->clip_y1; Y++) {
+		// sprite position of first clip column center in this row
+		u0 = a * (self->clip_x0 - x) + b * (Y - y) + (a + b) / 2 + pu;
+		v0 = -b * (self->clip_x0 - x) + a * (Y - y) + (a - b) / 2 + pv;
+
+		lo = 0;
+		hi = self->clip_x1 - self->clip_x0;
+		TFT_spanLimit(u0, a, ((long long)s->w << 16) - 1, &lo, &hi);
+		TFT_spanLimit(v0, -b, ((long long)s->h << 16) - 1, &lo, &hi);
+		if (lo > hi) continue;
+
+		u = u0 + a * lo;
+		v = v0 - b * lo;
+		n = hi - lo + 1;
+
+		for (i=0, p=line; i<n; i++, p+=2, u+=a, v-=b) {
+			on[i] = TFT_spriteOpaqueAt(s, mask, u >> 16, v >> 16);
+			c = bilinear ? TFT_spriteSample(s, mask, u, v) : (s->pixels[((v >> 16) * s->w + (u >> 16)) * 2] << 8)
+				| s->pixels[((v >> 16) * s->w + (u >> 16)) * 2 + 1];
+			p[0] = c >> 8;
+			p[1] = c & 0xff;
+		}
+
+		// one window per opaque run
+		X = self->clip_x0 + lo;
+		for (i=0; i<n; i=k) {
+			for (k=i; k<n && on[k] == on[i]; k++);
+			if (on[i]) {
+				TFT_setWindow(self, X + i, Y, X + k - 1, Y);
+				TFT_pushBytes(self, line + i * 2, (k - i) * 2);
+				TFT_flush(self);
+			}
+		}
+	}
+
+	free(mask);
+}
+
+static PyObject *
+ili9341_blitTransformed(ILI9341PyObject *self, PyObject *args, PyObject *kwds) {
+	PyObject *sprite, *pivot = Py_None;
+	SpritePyObject *s;
+	int x, y;
+	long long a;
+	double angle = 0, scale = 1, pu, pv;
+	char *filter = "nearest";
+	static char *kwlist[] = {"sprite", "x", "y", "angle", "scale", "pivot", "filter", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!ii|ddOs", kwlist, &SpriteObjectType, &sprite,
+			&x, &y, &angle, &scale, &pivot, &filter)) {
+		return NULL;
+	}
+
+	s = (SpritePyObject *)sprite;
+	if (s->pixels == NULL) {
+		PyErr_SetString(PyExc_ValueError, "sprite is not initialized");
+		return NULL;
+	}
+
+	if (scale < 1.0 / 64 || scale > 64) {
+		PyErr_SetString(PyExc_ValueError, "scale must be between 1/64 and 64");
+		return NULL;
+	}
+
+	if (strcmp(filter, "nearest") != 0 && strcmp(filter, "bilinear") != 0) {
+		PyErr_Format(PyExc_ValueError, "unknown filter %s", filter);
+		return NULL;
+	}
+
+	pu = s->w / 2.0;
+	pv = s->h / 2.0;
+	if (pivot != Py_None && !PyArg_ParseTuple(pivot, "dd", &pu, &pv)) {
+		return NULL;
+	}
+
+	// the only floating point math, converting arguments to fixed point
+	a = (long long)(angle * 256 + (angle < 0 ? -0.5 : 0.5)) % (360 * 256);
+	if (a < 0) a += 360 * 256;
+	TFT_blitTransformed(self, s, x, y, a, (int)(scale * 65536 + 0.5),
+		(int)(pu * 65536), (int)(pv * 65536), filter[0] == 'b');
+
+	Py_RETURN_NONE;
+}
+
+static void
+ili9341_dealloc(ILI9341PyObject *self) {
+	TFT_fbFree(self);
+	TFT_cacheTrim(&self->glyph_cache, 0);
+	TFT_cacheTrim(&self->text_cache, 0);
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyMethodDef ili9341_methods[] = {
+	{"clear", (PyCFunction)ili9341_clear, METH_NOARGS,
+		"clear()\n\n Clear LCD display."},
+	{"rotation", (PyCFunction)ili9341_rotation, METH_VARARGS,
+		"rotation(mode)\n\n Set rotation mode (0-3)."},
+	{"invert", (PyCFunction)ili9341_invert, METH_VARARGS,
+		"invert(mode)\n\n Invert LCD display."},
+	{"rgb2color", (PyCFunction)ili9341_rgb2color, METH_VARARGS,
+		"rgb2color(r, g, b)\n\n Convert RGB to internal color."},
+	{"pixel", (PyCFunction)ili9341_drawPixel, METH_VARARGS,
+		"pixel(x, y, color)\n\n Draws pixel at specified location and color on LCD display."},
+	{"circle", (PyCFunction)ili9341_drawCircle, METH_VARARGS,
+		"circle(x, y, radius, color)\n\n Draws circle at specified location, radius and color on LCD display."},
+	{"circle_fill", (PyCFunction)ili9341_fillCircle, METH_VARARGS,
+		"circle_fill(x, y, radius, color)\n\n Draws and fills circle at specified location, radius and color on LCD display."},
+	{"line", (PyCFunction)ili9341_drawLine, METH_VARARGS | METH_KEYWORDS,
+		"line(x0, y0, x1, y1, color, width=1)\n\n Draws line at specified locations, color and width on LCD display."},
+	{"line_vertical", (PyCFunction)ili9341_drawFastVLine, METH_VARARGS,
+		"line_vertical(x, y, len, color)\n\n Draws vertical line at specified location, length and color on LCD display."},
+	{"line_horisontal", (PyCFunction)ili9341_drawFastHLine, METH_VARARGS,
+		"line_horisontal(x, y, len, color)\n\n Draws horisontal line at specified location, length and color on LCD display."},
+	{"triangle", (PyCFunction)ili9341_drawTriangle, METH_VARARGS,
+		"triangle(x0, y0, x1, y1, x2, y2, color)\n\n Draws triangle at specified location and color on LCD display."},
+	{"rect", (PyCFunction)ili9341_drawRect, METH_VARARGS,
+		"rect(x, y, w, h, color)\n\n Draws rect at specified location, width, height and color on LCD display."},
+	{"rect_fill", (PyCFunction)ili9341_fillRect, METH_VARARGS,
+		"rect_fill(x, y, w, h, color)\n\n Draws and fills rect at specified location, width, height and color on LCD display."},
+	{"round_rect", (PyCFunction)ili9341_roundRect, METH_VARARGS,
+		"round_rect(x, y, w, h, r, color)\n\n Draws rect with corners rounded to radius r."},
+	{"round_rect_fill", (PyCFunction)ili9341_fillRoundRect, METH_VARARGS,
+		"round_rect_fill(x, y, w, h, r, color)\n\n Draws and fills rect with corners rounded to radius r."},
+	{"arc", (PyCFunction)ili9341_arc, METH_VARARGS | METH_KEYWORDS,
+		"arc(x, y, r, start, end, thickness=1, color=None)\n\n Draws arc from start to end degrees, clockwise from 3 o'clock, thickness pixels inwards from radius r, in current color if color is None."},
+	{"pie_fill", (PyCFunction)ili9341_fillPie, METH_VARARGS,
+		"pie_fill(x, y, r, start, end, color)\n\n Draws and fills pie slice from start to end degrees, clockwise from 3 o'clock."},
+	{"gradient_rect", (PyCFunction)ili9341_gradientRect, METH_VARARGS | METH_KEYWORDS,
+		"gradient_rect(x, y, w, h, color0, color1, vertical=1)\n\n Fill rect with linear gradient from color0 at top (or left) to color1 at bottom (or right) edge."},
+	{"gradient_circle", (PyCFunction)ili9341_gradientCircle, METH_VARARGS,
+		"gradient_circle(x, y, r, color0, color1)\n\n Fill circle with radial gradient from color0 in the center to color1 at the edge."},
+	{"color", (PyCFunction)ili9341_setColor, METH_VARARGS,
+		"bg_color(c)\n\n Set foreground color."},
+	{"bg_color", (PyCFunction)ili9341_setBgColor, METH_VARARGS,
+		"bg_color(c)\n\n Set background color."},
+	{"cursor", (PyCFunction)ili9341_setCursor, METH_VARARGS,
+		"cursor(x, y)\n\n Set text cursor at specified location."},
+	{"font", (PyCFunction)ili9341_setFont, METH_VARARGS | METH_KEYWORDS,
+		"font(name, spacing=1)\n\n Set text font name and char spacing."},
+	{"load_font", (PyCFunction)ili9341_loadFont, METH_VARARGS | METH_KEYWORDS,
+		"load_font(path, name=None)\n\n Map font file and register it under name, file name without extension by default. Returns the name."},
+	{"fallback", (PyCFunction)ili9341_fallback, METH_VARARGS,
+		"fallback(name, ...)\n\n Set fonts searched in order for chars current font lacks, none clears the list."},
+	{"glyph_cache", (PyCFunction)ili9341_glyphCache, METH_VARARGS,
+		"glyph_cache(bytes)\n\n Set memory budget of rendered glyph cache, 0 disables it."},
+	{"text_cache", (PyCFunction)ili9341_textCache, METH_VARARGS,
+		"text_cache(bytes)\n\n Set memory budget of cache of strings written with cache=1, 0 disables it."},
+	{"char", (PyCFunction)ili9341_drawChar, METH_VARARGS | METH_KEYWORDS,
+		"char(ch, x=0, y=0, color=1)\n\n Draw char at current or specified position with current font and size."},
+	{"write", (PyCFunction)ili9341_writeString, METH_VARARGS | METH_KEYWORDS,
+		"write(string, x=0, y=0, color=1, direction=0, cache=0, transparent=0)\n\n Draw UTF-8 or unicode string at current or specified position with current font and size, rotated clockwise by direction degrees. With cache rendered lines are kept for next time, transparent text draws only set pixels."},
+	{"text_size", (PyCFunction)ili9341_textSize, METH_VARARGS | METH_KEYWORDS,
+		"text_size(string, font=None)\n\n Width and height of string drawn with current or named font, lines split at newlines."},
+	{"layout", (PyCFunction)ili9341_layout, METH_VARARGS | METH_KEYWORDS,
+		"layout(string, w, h, align='left', wrap='word', font=None)\n\n Break string into lines fitting w by h box, returns list of (start, end, x, y, width)."},
+	{"write_box", (PyCFunction)ili9341_writeBox, METH_VARARGS | METH_KEYWORDS,
+		"write_box(string, x, y, w, h, align='left', wrap='word', color=1, cache=0, transparent=0)\n\n Draw string laid out in box with current font, rest of box is filled with background unless transparent."},
+	{"jpeg", (PyCFunction)ili9341_showJpeg, METH_VARARGS | METH_KEYWORDS,
+		"jpeg(filename, x=0, y=0)\n\n Show jpeg file at current or specified position."},
+	{"rle_image", (PyCFunction)ili9341_rleImage, METH_VARARGS | METH_KEYWORDS,
+		"rle_image(src, x=0, y=0)\n\n Show RLE image from file name or string at current or specified position."},
+	{"lz4_image", (PyCFunction)ili9341_lz4Image, METH_VARARGS | METH_KEYWORDS,
+		"lz4_image(src, x=0, y=0)\n\n Show LZ4 compressed RGB565 image from file name or string at current or specified position."},
+	{"rgb_to_565", (PyCFunction)ili9341_rgbTo565, METH_VARARGS | METH_KEYWORDS,
+		"rgb_to_565(data, format='rgb', dither=None, width=0)\n\n Convert rgb, bgr, rgbx or gray pixels to big-endian RGB565 string, dithered as rows of width pixels."},
+	{"dither", (PyCFunction)ili9341_setDither, METH_VARARGS,
+		"dither(mode)\n\n Set dithering of true color images: none, ordered or fs."},
+	{"rop", (PyCFunction)ili9341_setRop, METH_VARARGS,
+		"rop(mode)\n\n Set raster op combining drawn pixels with display content: copy, xor, and or or."},
+	{"flood_fill", (PyCFunction)ili9341_floodFill, METH_VARARGS,
+		"flood_fill(x, y, color)\n\n Fill area of same color connected to x, y."},
+	{"framebuffer", (PyCFunction)ili9341_framebuffer, METH_VARARGS,
+		"framebuffer(bpp)\n\n Draw into 8, 4 or 1 bpp palette framebuffer, colors become palette indices. 0 draws to display again."},
+	{"palette", (PyCFunction)ili9341_palette, METH_VARARGS,
+		"palette(index, color=None)\n\n Get or set RGB565 color of framebuffer palette entry."},
+	{"flush", (PyCFunction)ili9341_flush, METH_NOARGS,
+		"flush()\n\n Send changed framebuffer pixels to display."},
+	{"bitmap", (PyCFunction)ili9341_bitmap, METH_VARARGS | METH_KEYWORDS,
+		"bitmap(data, x, y, w, h, fg, bg=None, lsb_first=0)\n\n Draw 1 bit per pixel bitmap, set bits in fg and clear ones in bg color or transparent when bg is None."},
+	{"blend", (PyCFunction)ili9341_blend, METH_VARARGS | METH_KEYWORDS,
+		"blend(data, x, y, w, h)\n\n Composite w*h RGBA pixels over display content at specified position."},
+	{"draw_sprite", (PyCFunction)ili9341_drawSprite, METH_VARARGS | METH_KEYWORDS,
+		"draw_sprite(sprite, x=0, y=0)\n\n Draw sprite at current or specified position, skipping transparent pixels."},
+	{"blit_transformed", (PyCFunction)ili9341_blitTransformed, METH_VARARGS | METH_KEYWORDS,
+		"blit_transformed(sprite, x, y, angle=0, scale=1, pivot=None, filter='nearest')\n\n Draw sprite rotated clockwise by angle degrees and scaled around pivot, which lands on x, y."},
+	{"hide_sprite", (PyCFunction)ili9341_hideSprite, METH_VARARGS,
+		"hide_sprite(sprite)\n\n Restore background saved under the sprite."},
+	{NULL}
+};
+
+static PyTypeObject ILI9341ObjectType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size        */
+	"ILI9341",		/* tp_name        */
+	sizeof(ILI9341PyObject),		/* tp_basicsize   */
+	0,				/* tp_itemsize    */
+	(destructor)ili9341_dealloc,	/* tp_dealloc     */
+	0,				/* tp_print       */
+	0,				/* tp_getattr     */
+	0,				/* tp_setattr     */
+	0,				/* tp_compare     */
+	0,				/* tp_repr        */
+	0,				/* tp_as_number   */
+	0,				/* tp_as_sequence */
+	0,				/* tp_as_mapping  */
+	0,				/* tp_hash        */
+	0,				/* tp_call        */
+	0,				/* tp_str         */
+	0,				/* tp_getattro    */
+	0,				/* tp_setattro    */
+	0,				/* tp_as_buffer   */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags       */
+	"ILI9341(bus, chip_select, pin_dc, pin_reset) -> LCD\n\nReturn a new ILI9341 object that is connected to the specified bus and pins.\n",	/* tp_doc         */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	ili9341_methods,	/* tp_methods        */
+	ili9341_members,	/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)ili9341_init,		/* tp_init           */
+};
+
+/*
+ * Scene - retained display list. Elements keep stable ids and z-order
+ * (insertion order), changes only collect damaged areas and render()
+ * repaints the elements intersecting them, back to front.
+ */
+
+#define SCENE_RECT	0
+#define SCENE_LINE	1
+#define SCENE_TEXT	2
+#define SCENE_IMAGE	3
+
+#define SCENE_MAX_DAMAGE	32
+#define SCENE_MAX_PIECES	64
+
+#define SCENE_UNSET	INT_MIN
+
+typedef struct {
+	int x0, y0, x1, y1;	/* x1, y1 are exclusive */
+} tft_rect;
+
+typedef struct {
+	int id;
+	int type;
+	int visible;
+	int x, y, w, h;		/* lines use x, y - x1, y1 as end points */
+	int x1, y1;
+	int color, bg;
+	int fill;
+	int spacing;
+	tft_font *font;
+	char *text;
+	unsigned char *data;
+} scene_element;
+
+typedef struct {
+	PyObject_HEAD
+
+	ILI9341PyObject *lcd;
+	int bg_color;
+	int next_id;
+
+	int count, size;
+	scene_element *elements;
+
+	int damage_count;
+	tft_rect damage[SCENE_MAX_DAMAGE];
+} ScenePyObject;
+
+static
+int rect_empty(tft_rect *r) {
+	return r->x0 >= r->x1 || r->y0 >= r->y1;
+}
+
+static
+int rect_intersect(tft_rect *a, tft_rect *b, tft_rect *out) {
+	out->x0 = a->x0 > b->x0 ? a->x0 : b->x0;
+	out->y0 = a->y0 > b->y0 ? a->y0 : b->y0;
+	out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+	out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+
+	return !rect_empty(out);
+}
+
+// a contains b
+static
+int rect_contains(tft_rect *a, tft_rect *b) {
+	return b->x0 >= a->x0 && b->y0 >= a->y0 && b->x1 <= a->x1 && b->y1 <= a->y1;
+}
+
+static
+void rect_union(tft_rect *a, tft_rect *b, tft_rect *out) {
+	out->x0 = a->x0 < b->x0 ? a->x0 : b->x0;
+	out->y0 = a->y0 < b->y0 ? a->y0 : b->y0;
+	out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+	out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+}
+
+static
+int rect_area(tft_rect *r) {
+	return (r->x1 - r->x0) * (r->y1 - r->y0);
+}
+
+// a minus b as up to 4 non overlapping rects: full width bands above and
+// below b, then the left and right parts beside it
+static
+int rect_subtract(tft_rect *a, tft_rect *b, tft_rect *out) {
+	tft_rect i;
+	int n = 0;
+
+	if (!rect_intersect(a, b, &i)) {
+		out[n++] = *a;
+		return n;
+	}
+
+	if (a->y0 < i.y0) {
+		out[n].x0 = a->x0; out[n].y0 = a->y0; out[n].x1 = a->x1; out[n].y1 = i.y0;
+		n++;
+	}
+	if (i.y1 < a->y1) {
+		out[n].x0 = a->x0; out[n].y0 = i.y1; out[n].x1 = a->x1; out[n].y1 = a->y1;
+		n++;
+	}
+	if (a->x0 < i.x0) {
+		out[n].x0 = a->x0; out[n].y0 = i.y0; out[n].x1 = i.x0; out[n].y1 = i.y1;
+		n++;
+	}
+	if (i.x1 < a->x1) {
+		out[n].x0 = i.x1; out[n].y0 = i.y0; out[n].x1 = a->x1; out[n].y1 = i.y1;
+		n++;
+	}
+
+	return n;
+}
+
+// decoded text of element in its font, NULL when out of memory
+static
+tft_char *scene_textChars(ILI9341PyObject *lcd, scene_element *e, int *n) {
+	tft_font *font = lcd->font;
+	tft_char *str;
+	int len = strlen(e->text);
+
+	if ((str = malloc((len + 1) * sizeof(tft_char))) == NULL) {
+		return NULL;
+	}
+
+	lcd->font = e->font;
+	*n = TFT_decode(lcd, (unsigned char *)e->text, len, str);
+	lcd->font = font;
+
+	return str;
+}
+
+// columns TFT_text paints relative to e->x, glyphs may overlap and reach
+// left or past the last one with negative spacing
+static
+void scene_textSpan(ILI9341PyObject *lcd, scene_element *e, int *x0, int *x1) {
+	tft_char *str;
+	int i, n, x = 0;
+
+	*x0 = *x1 = 0;
+	if ((str = scene_textChars(lcd, e, &n)) == NULL) {
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		if (x < *x0) *x0 = x;
+		if (x + str[i].width > *x1) *x1 = x + str[i].width;
+		x += str[i].width + e->spacing;
+	}
+	free(str);
+}
+
+static
+void scene_bounds(ScenePyObject *self, scene_element *e, tft_rect *r) {
+	switch (e->type) {
+		case SCENE_LINE:
+			r->x0 = e->x < e->x1 ? e->x : e->x1;
+			r->y0 = e->y < e->y1 ? e->y : e->y1;
+			r->x1 = (e->x > e->x1 ? e->x : e->x1) + 1;
+			r->y1 = (e->y > e->y1 ? e->y : e->y1) + 1;
+			break;
+		case SCENE_TEXT:
+			scene_textSpan(self->lcd, e, &r->x0, &r->x1);
+			r->x0 += e->x;
+			r->y0 = e->y;
+			r->x1 += e->x;
+			r->y1 = e->y + TFT_fontRows(e->font);
+			break;
+		default:
+			r->x0 = e->x;
+			r->y0 = e->y;
+			r->x1 = e->x + e->w;
+			r->y1 = e->y + e->h;
+			break;
+	}
+}
+
+static
+int scene_opaque(scene_element *e) {
+	return e->visible && ((e->type == SCENE_RECT && e->fill) || e->type == SCENE_IMAGE);
+}
+
+static
+scene_element *scene_find(ScenePyObject *self, int id, int *index) {
+	int i;
+
+	for (i=0; i<self->count; i++) {
+		if (self->elements[i].id == id) {
+			if (index) *index = i;
+			return &self->elements[i];
+		}
+	}
+
+	PyErr_Format(PyExc_KeyError, "no scene element with id %d", id);
+	return NULL;
+}
+
+static
+void scene_addDamage(ScenePyObject *self, tft_rect *r) {
+	tft_rect screen = {0, 0, self->lcd->width, self->lcd->height}, d, u;
+	int i, best = 0, growth, best_growth = INT_MAX;
+
+	if (!rect_intersect(r, &screen, &d)) return;
+
+	for (i=0; i<self->damage_count; i++) {
+		if (rect_contains(&self->damage[i], &d)) return;
+
+		if (rect_contains(&d, &self->damage[i])) {
+			self->damage[i--] = self->damage[--self->damage_count];
+		}
+	}
+
+	if (self->damage_count < SCENE_MAX_DAMAGE) {
+		self->damage[self->damage_count++] = d;
+		return;
+	}
+
+	// out of slots, grow the rect that gets the least bigger
+	for (i=0; i<self->damage_count; i++) {
+		rect_union(&self->damage[i], &d, &u);
+		growth = rect_area(&u) - rect_area(&self->damage[i]);
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+
+	rect_union(&self->damage[best], &d, &self->damage[best]);
+}
+
+// damage r for element at index, minus areas covered by opaque elements above it
+static
+void scene_damage(ScenePyObject *self, int index, tft_rect *r) {
+	tft_rect pieces[2][SCENE_MAX_PIECES], out[4], b;
+	int i, j, k, m, n = 1, cur = 0, next;
+
+	if (rect_empty(r)) return;
+
+	pieces[cur][0] = *r;
+
+	for (i=index + 1; i<self->count && n > 0; i++) {
+		if (!scene_opaque(&self->elements[i])) continue;
+
+		scene_bounds(self, &self->elements[i], &b);
+		next = cur ^ 1;
+		m = 0;
+
+		for (j=0; j<n; j++) {
+			k = rect_subtract(&pieces[cur][j], &b, out);
+			if (m + k + (n - j - 1) > SCENE_MAX_PIECES) {
+				// too fragmented, keep the rest as is
+				pieces[next][m++] = pieces[cur][j];
+				continue;
+			}
+			while (k--) {
+				pieces[next][m++] = out[k];
+			}
+		}
+
+		n = m;
+		cur = next;
+	}
+
+	for (j=0; j<n; j++) {
+		scene_addDamage(self, &pieces[cur][j]);
+	}
+}
+
+static
+void scene_draw(ScenePyObject *self, scene_element *e) {
+	ILI9341PyObject *lcd = self->lcd;
+	tft_font *font;
+	tft_char *str;
+	int n, color, bg_color;
+
+	switch (e->type) {
+		case SCENE_RECT:
+			if (e->fill) {
+				TFT_fillRect(lcd, e->x, e->y, e->w, e->h, e->color);
+			} else {
+				TFT_rect(lcd, e->x, e->y, e->w, e->h, e->color);
+			}
+			break;
+		case SCENE_LINE:
+			TFT_line(lcd, e->x, e->y, e->x1, e->y1, e->color);
+			break;
+		case SCENE_IMAGE:
+			TFT_blit(lcd, e->x, e->y, e->w, e->h, e->data);
+			break;
+		case SCENE_TEXT:
+			if ((str = scene_textChars(lcd, e, &n)) == NULL) {
+				break;
+			}
+
+			font = lcd->font;
+			color = lcd->color;
+			bg_color = lcd->bg_color;
+
+			lcd->font = e->font;
+			lcd->color = e->color;
+			lcd->bg_color = e->bg;
+
+			TFT_text(lcd, str, n, e->x, e->y, e->spacing, 0);
+			free(str);
+
+			lcd->font = font;
+			lcd->color = color;
+			lcd->bg_color = bg_color;
+			break;
+	}
+}
+
+static
+void scene_freeElement(scene_element *e) {
+	free(e->text);
+	free(e->data);
+	e->text = NULL;
+	e->data = NULL;
+}
+
+static
+scene_element *scene_append(ScenePyObject *self, int type) {
+	scene_element *e;
+
+	if (self->count == self->size) {
+		int size = self->size ? self->size * 2 : 16;
+		e = realloc(self->elements, size * sizeof(scene_element));
+		if (e == NULL) {
+			PyErr_NoMemory();
+			return NULL;
+		}
+		self->elements = e;
+		self->size = size;
+	}
+
+	e = &self->elements[self->count++];
+	memset(e, 0, sizeof(scene_element));
+	e->id = self->next_id++;
+	e->type = type;
+	e->visible = 1;
+
+	return e;
+}
+
+// new element is on top, nothing can cover it
+static
+PyObject *scene_added(ScenePyObject *self, scene_element *e) {
+	tft_rect r;
+
+	scene_bounds(self, e, &r);
+	scene_damage(self, self->count - 1, &r);
+
+	return Py_BuildValue("i", e->id);
+}
+
+static int
+scene_init(ScenePyObject *self, PyObject *args, PyObject *kwds) {
+	PyObject *lcd;
+	int bg = 0;
+	static char *kwlist[] = {"lcd", "bg", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|i", kwlist, &ILI9341ObjectType, &lcd, &bg))
+		return -1;
+
+	Py_INCREF(lcd);
+	Py_XDECREF(self->lcd);
+	self->lcd = (ILI9341PyObject *)lcd;
+	self->bg_color = bg;
+	self->next_id = 1;
+	self->damage_count = 0;
+
+	return 0;
+}
+
+static void
+scene_dealloc(ScenePyObject *self) {
+	int i;
+
+	for (i=0; i<self->count; i++) {
+		scene_freeElement(&self->elements[i]);
+	}
+	free(self->elements);
+	Py_XDECREF(self->lcd);
+
+	self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyObject *
+scene_rect(ScenePyObject *self, PyObject *args, PyObject *kwds) {
+	int x, y, w, h, color, fill = 1;
+	scene_element *e;
+	static char *kwlist[] = {"x", "y", "w", "h", "color", "fill", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iiiii|i", kwlist, &x, &y, &w, &h, &color, &fill)) {
+		return NULL;
+	}
+
+	if ((e = scene_append(self, SCENE_RECT)) == NULL) {
+		return NULL;
+	}
+
+	e->x = x;
+	e->y = y;
+	e->w = w;
+	e->h = h;
+	e->color = color;
+	e->fill = fill;
+
+	return scene_added(self, e);
+}
+
+static PyObject *
+scene_line(ScenePyObject *self, PyObject *args) {
+	int x0, y0, x1, y1, color;
+	scene_element *e;
+
+	if (!PyArg_ParseTuple(args, "iiiii", &x0, &y0, &x1, &y1, &color)) {
+		return NULL;
+	}
+
+	if ((e = scene_append(self, SCENE_LINE)) == NULL) {
+		return NULL;
+	}
+
+	e->x = x0;
+	e->y = y0;
+	e->x1 = x1;
+	e->y1 = y1;
+	e->color = color;
+
+	return scene_added(self, e);
+}
+
+static PyObject *
+scene_text(ScenePyObject *self, PyObject *args, PyObject *kwds) {
+	int x, y, color = self->lcd->color, bg = self->lcd->bg_color, spacing = self->lcd->char_spacing;
+	char *str, *font = NULL;
+	tft_font *data = self->lcd->font;
+	scene_element *e;
+	static char *kwlist[] = {"x", "y", "str", "color", "bg", "font", "spacing", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iis|iizi", kwlist, &x, &y, &str, &color, &bg, &font, &spacing)) {
+		return NULL;
+	}
+
+	if (font != NULL && (data = TFT_findFont(font)) == NULL) {
+		PyErr_Format(PyExc_ValueError, "unknown font %s", font);
+		return NULL;
+	}
+
+	if ((e = scene_append(self, SCENE_TEXT)) == NULL) {
+		return NULL;
+	}
+
+	if ((e->text = strdup(str)) == NULL) {
+		self->count--;
+		return PyErr_NoMemory();
+	}
+
+	e->x = x;
+	e->y = y;
+	e->color = color;
+	e->bg = bg;
+	e->font = data;
+	e->spacing = spacing;
+
+	return scene_added(self, e);
+}
+
+static PyObject *
+scene_image(ScenePyObject *self, PyObject *args) {
+	int x, y, w, h, len;
+	unsigned char *data;
+	scene_element *e;
+
+	if (!PyArg_ParseTuple(args, "iiiis#", &x, &y, &w, &h, &data, &len)) {
+		return NULL;
+	}
+
+	if (TFT_areaSize(w, h, 2) != len) {
+		PyErr_SetString(PyExc_ValueError, "image data must be w*h RGB565 pixels");
+		return NULL;
+	}
+
+	if ((e = scene_append(self, SCENE_IMAGE)) == NULL) {
+		return NULL;
+	}
+
+	if ((e->data = malloc(len)) == NULL) {
+		self->count--;
+		return PyErr_NoMemory();
+	}
+	memcpy(e->data, data, len);
+
+	e->x = x;
+	e->y = y;
+	e->w = w;
+	e->h = h;
+
+	return scene_added(self, e);
+}
+
+static PyObject *
+scene_set(ScenePyObject *self, PyObject *args, PyObject *kwds) {
+	int id, index, len = 0;
+	int x = SCENE_UNSET, y = SCENE_UNSET, w = SCENE_UNSET, h = SCENE_UNSET;
+	int x1 = SCENE_UNSET, y1 = SCENE_UNSET, color = SCENE_UNSET, bg = SCENE_UNSET;
+	int fill = SCENE_UNSET, visible = SCENE_UNSET;
+	char *text = NULL, *font = NULL, *textCopy = NULL;
+	unsigned char *data = NULL, *dataCopy = NULL;
+	tft_font *fontData = NULL;
+	scene_element *e;
+	tft_rect before, after;
+	static char *kwlist[] = {"id", "x", "y", "w", "h", "x1", "y1", "color", "bg", "fill", "visible", "text", "font", "data", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|iiiiiiiiiizzz#", kwlist, &id, &x, &y, &w, &h, &x1, &y1,
+			&color, &bg, &fill, &visible, &text, &font, &data, &len)) {
+		return NULL;
+	}
+
+	if ((e = scene_find(self, id, &index)) == NULL) {
+		return NULL;
+	}
+
+	if (font != NULL && (fontData = TFT_findFont(font)) == NULL) {
+		PyErr_Format(PyExc_ValueError, "unknown font %s", font);
+		return NULL;
+	}
+
+	if (data != NULL) {
+		if (e->type != SCENE_IMAGE) {
+			PyErr_SetString(PyExc_ValueError, "data can only be set on images");
+			return NULL;
+		}
+		if (TFT_areaSize(w != SCENE_UNSET ? w : e->w, h != SCENE_UNSET ? h : e->h, 2) != len) {
+			PyErr_SetString(PyExc_ValueError, "image data must be w*h RGB565 pixels");
+			return NULL;
+		}
+	} else if (e->type == SCENE_IMAGE && (w != SCENE_UNSET || h != SCENE_UNSET)) {
+		PyErr_SetString(PyExc_ValueError, "image size can only change together with data");
+		return NULL;
+	}
+
+	if (text != NULL && e->type == SCENE_TEXT) {
+		if ((textCopy = strdup(text)) == NULL) {
+			return PyErr_NoMemory();
+		}
+	}
+
+	if (data != NULL) {
+		if ((dataCopy = malloc(len)) == NULL) {
+			free(textCopy);
+			return PyErr_NoMemory();
+		}
+		memcpy(dataCopy, data, len);
 	}
 
-	return ret;
-}
+	if (e->visible) {
+		scene_bounds(self, e, &before);
+		scene_damage(self, index, &before);
+	}
+
+	if (textCopy != NULL) {
+		free(e->text);
+		e->text = textCopy;
+	}
+
+	if (dataCopy != NULL) {
+		free(e->data);
+		e->data = dataCopy;
+	}
+
+	if (x != SCENE_UNSET) e->x = x;
+	if (y != SCENE_UNSET) e->y = y;
+	if (w != SCENE_UNSET) e->w = w;
+	if (h != SCENE_UNSET) e->h = h;
+	if (x1 != SCENE_UNSET) e->x1 = x1;
+	if (y1 != SCENE_UNSET) e->y1 = y1;
+	if (color != SCENE_UNSET) e->color = color;
+	if (bg != SCENE_UNSET) e->bg = bg;
+	if (fill != SCENE_UNSET) e->fill = fill;
+	if (visible != SCENE_UNSET) e->visible = visible;
+	if (fontData != NULL) e->font = fontData;
+
+	if (e->visible) {
+		scene_bounds(self, e, &after);
+		scene_damage(self, index, &after);
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+scene_remove(ScenePyObject *self, PyObject *args) {
+	int id, index;
+	scene_element *e;
+	tft_rect r;
+
+	if (!PyArg_ParseTuple(args, "i", &id)) {
+		return NULL;
+	}
+
+	if ((e = scene_find(self, id, &index)) == NULL) {
+		return NULL;
+	}
+
+	if (e->visible) {
+		scene_bounds(self, e, &r);
+		scene_damage(self, index, &r);
+	}
+
+	scene_freeElement(e);
+	memmove(e, e + 1, (self->count - index - 1) * sizeof(scene_element));
+	self->count--;
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+scene_invalidate(ScenePyObject *self, PyObject *unused) {
+	tft_rect r = {0, 0, self->lcd->width, self->lcd->height};
+
+	self->damage_count = 0;
+	scene_addDamage(self, &r);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+scene_render(ScenePyObject *self, PyObject *unused) {
+	ILI9341PyObject *lcd = self->lcd;
+	scene_element *e;
+	tft_rect *d, b, tmp;
+	int i, j, start;
+
+	for (i=0; i<self->damage_count; i++) {
+		d = &self->damage[i];
+
+		// nothing below the topmost opaque element covering it can show through
+		start = -1;
+		for (j=self->count - 1; j>=0; j--) {
+			if (scene_opaque(&self->elements[j])) {
+				scene_bounds(self, &self->elements[j], &b);
+				if (rect_contains(&b, d)) {
+					start = j;
+					break;
+				}
+			}
+		}
+
+		lcd->clip_x0 = d->x0;
+		lcd->clip_y0 = d->y0;
+		lcd->clip_x1 = d->x1 - 1;
+		lcd->clip_y1 = d->y1 - 1;
+
+		if (start < 0) {
+			TFT_fillRect(lcd, d->x0, d->y0, d->x1 - d->x0, d->y1 - d->y0, self->bg_color);
+			start = 0;
+		}
+
+		for (j=start; j<self->count; j++) {
+			e = &self->elements[j];
+			if (!e->visible) continue;
+
+			scene_bounds(self, e, &b);
+			if (rect_intersect(&b, d, &tmp)) {
+				scene_draw(self, e);
+			}
+		}
+	}
+
+	self->damage_count = 0;
+	TFT_resetClip(lcd);
+
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef scene_methods[] = {
+	{"rect", (PyCFunction)scene_rect, METH_VARARGS | METH_KEYWORDS,
+		"rect(x, y, w, h, color, fill=1) -> id\n\n Add rect element on top of the scene."},
+	{"line", (PyCFunction)scene_line, METH_VARARGS,
+		"line(x0, y0, x1, y1, color) -> id\n\n Add line element on top of the scene."},
+	{"text", (PyCFunction)scene_text, METH_VARARGS | METH_KEYWORDS,
+		"text(x, y, str, color=lcd color, bg=lcd bg, font=None, spacing=lcd spacing) -> id\n\n Add text run on top of the scene, colors and font default to current LCD ones."},
+	{"image", (PyCFunction)scene_image, METH_VARARGS,
+		"image(x, y, w, h, data) -> id\n\n Add image element from big-endian RGB565 data on top of the scene."},
+	{"set", (PyCFunction)scene_set, METH_VARARGS | METH_KEYWORDS,
+		"set(id, x, y, w, h, x1, y1, color, bg, fill, visible, text, font, data)\n\n Change element properties, only given ones are updated."},
+	{"remove", (PyCFunction)scene_remove, METH_VARARGS,
+		"remove(id)\n\n Remove element from the scene."},
+	{"invalidate", (PyCFunction)scene_invalidate, METH_NOARGS,
+		"invalidate()\n\n Mark whole screen for redraw."},
+	{"render", (PyCFunction)scene_render, METH_NOARGS,
+		"render()\n\n Redraw damaged areas of the scene."},
+	{NULL}
+};
+
+static PyTypeObject SceneObjectType = {
+	PyObject_HEAD_INIT(NULL)
+	0,				/* ob_size        */
+	"Scene",		/* tp_name        */
+	sizeof(ScenePyObject),		/* tp_basicsize   */
+	0,				/* tp_itemsize    */
+	(destructor)scene_dealloc,	/* tp_dealloc     */
+	0,				/* tp_print       */
+	0,				/* tp_getattr     */
+	0,				/* tp_setattr     */
+	0,				/* tp_compare     */
+	0,				/* tp_repr        */
+	0,				/* tp_as_number   */
+	0,				/* tp_as_sequence */
+	0,				/* tp_as_mapping  */
+	0,				/* tp_hash        */
+	0,				/* tp_call        */
+	0,				/* tp_str         */
+	0,				/* tp_getattro    */
+	0,				/* tp_setattro    */
+	0,				/* tp_as_buffer   */
+	Py_TPFLAGS_DEFAULT,		/* tp_flags       */
+	"Scene(lcd, bg=0) -> scene\n\nReturn a new retained display list drawing on the specified LCD.\n",	/* tp_doc         */
+	0,				/* tp_traverse       */
+	0,				/* tp_clear          */
+	0,				/* tp_richcompare    */
+	0,				/* tp_weaklistoffset */
+	0,				/* tp_iter           */
+	0,				/* tp_iternext       */
+	scene_methods,	/* tp_methods        */
+	0,				/* tp_members        */
+	0,				/* tp_getset         */
+	0,				/* tp_base           */
+	0,				/* tp_dict           */
+	0,				/* tp_descr_get      */
+	0,				/* tp_descr_set      */
+	0,				/* tp_dictoffset     */
+	(initproc)scene_init,		/* tp_init           */
+};
+
+/*
+ * Tilemap - grid of fixed size RGB565 tiles. Map changes only redraw the
+ * changed cells, runs of neighbouring cells on a row go out as one window.
+ */
 
-static
-int gpioSetDirection(int gpio, int direction) {
-	int fd, len, ret = -1;
-	char buf[255];
+typedef struct {
+	PyObject_HEAD
 
-	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/direction", gpio);
-    fd = open(buf, O_WRONLY);
-	
-	if (fd) {
-		if (direction) {
-			write(fd, "out", 3);
-		}
-		else {
-			write(fd, "in", 2);
+	ILI9341PyObject *lcd;
+	int x, y;
+	int tile_w, tile_h, tile_count;
+	int cols, rows;
+
+	unsigned char *tiles;	/* tile_count * tile_w*tile_h big-endian RGB565 */
+	unsigned short *map;	/* cols*rows tile indices */
+	unsigned char *dirty;
+} TilemapPyObject;
+
+static PyMemberDef tilemap_members[] = {
+	{"cols", T_INT, offsetof(TilemapPyObject, cols), READONLY,
+		"Map columns"},
+	{"rows", T_INT, offsetof(TilemapPyObject, rows), READONLY,
+		"Map rows"},
+	{NULL}  /* Sentinel */
+};
+
+// draw cells c0..c1 of row as one window
+static
+void tilemap_drawRun(TilemapPyObject *self, int row, int c0, int c1) {
+	ILI9341PyObject *lcd = self->lcd;
+	int rx = self->x + c0 * self->tile_w, ry = self->y + row * self->tile_h;
+	int x = rx, y = ry, w = (c1 - c0 + 1) * self->tile_w, h = self->tile_h;
+	int tile_size = self->tile_w * self->tile_h * 2;
+	int px, py, off, n;
+	unsigned char *tile;
+
+	if (!TFT_clipRect(lcd, &x, &y, &w, &h)) return;
+
+	TFT_setWindow(lcd, x, y, x + w - 1, y + h - 1);
+
+	for (py=y; py<y + h; py++) {
+		for (px=x; px<x + w; px+=n) {
+			off = (px - rx) % self->tile_w;
+			n = self->tile_w - off;
+			if (n > x + w - px) n = x + w - px;
+
+			tile = self->tiles + self->map[row * self->cols + c0 + (px - rx) / self->tile_w] * tile_size;
+			TFT_pushBytes(lcd, tile + ((py - ry) * self->tile_w + off) * 2, n * 2);
 		}
-		close(fd);
-		ret = 0;
 	}
 
-	return ret;
+	TFT_flush(lcd);
 }
 
 static
-int gpioOpenSet(int gpio) {
-	char buf[255];
+void tilemap_drawDirty(TilemapPyObject *self) {
+	unsigned char *dirty = self->dirty;
+	int row, col, start;
+
+	for (row=0; row<self->rows; row++, dirty+=self->cols) {
+		for (col=0; col<self->cols; ) {
+			if (!dirty[col]) {
+				col++;
+				continue;
+			}
 
-	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio);
+			start = col;
+			while (col < self->cols && dirty[col]) {
+				dirty[col++] = 0;
+			}
 
-	return open(buf, O_WRONLY);
+			tilemap_drawRun(self, row, start, col - 1);
+		}
+	}
 }
 
 static
-void gpioCloseSet(int gpio_fd) {
-	if (gpio_fd) {
-		close(gpio_fd);
+int tilemap_setCell(TilemapPyObject *self, int col, int row, int index) {
+	int i = row * self->cols + col;
+
+	if (col < 0 || col >= self->cols || row < 0 || row >= self->rows) {
+		PyErr_Format(PyExc_IndexError, "cell %d,%d is out of map", col, row);
+		return -1;
 	}
-}
 
-static
-void gpioSet(int gpio_fd, int value) {
-	if (gpio_fd) {
-		if (value) {
-			write(gpio_fd, "1", 2);
-		}
-		else {
-			write(gpio_fd, "0", 2);
-		}
+	if (index < 0 || index >= self->tile_count) {
+		PyErr_Format(PyExc_ValueError, "no tile %d", index);
+		return -1;
 	}
-}
 
-static
-void TFT_sendByte(ILI9341PyObject *self, char data) {
-    struct spi_ioc_transfer xfer;
-   
-	memset(&xfer, 0, sizeof(xfer));
-    xfer.tx_buf = (unsigned long)&data;
-    xfer.len = sizeof(char);
+	if (self->map[i] != index) {
+		self->map[i] = index;
+		self->dirty[i] = 1;
+	}
 
-    ioctl(self->fd, SPI_IOC_MESSAGE(1), &xfer);
+	return 0;
 }
 
-static
-void TFT_sendCMD(ILI9341PyObject *self, int index) {
-    TFT_DC_LOW;
-    TFT_sendByte(self, index);
-}
+static int
+tilemap_init(TilemapPyObject *self, PyObject *args, PyObject *kwds) {
+	PyObject *lcd;
+	unsigned char *tiles;
+	int len, tile_w, tile_h, cols, rows, x = 0, y = 0;
+	long long tile_size, cells;
+	static char *kwlist[] = {"lcd", "tiles", "tile_w", "tile_h", "cols", "rows", "x", "y", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!s#iiii|ii", kwlist, &ILI9341ObjectType, &lcd,
+			&tiles, &len, &tile_w, &tile_h, &cols, &rows, &x, &y))
+		return -1;
 
-static
-void TFT_sendDATA(ILI9341PyObject *self, int data) {
-    TFT_DC_HIGH;
-    TFT_sendByte(self, data);
-}
+	if (self->tiles != NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "tilemap is already initialized");
+		return -1;
+	}
 
-static
-void TFT_sendWord(ILI9341PyObject *self, int data) {
-    TFT_DC_HIGH;
+	// tile size is at most len, so it fits an int once checked
+	tile_size = TFT_areaSize(tile_w, tile_h, 2);
+	if (tile_size < 0 || tile_size > len || len % tile_size != 0) {
+		PyErr_SetString(PyExc_ValueError, "tiles must be tile_w*tile_h RGB565 pixels each");
+		return -1;
+	}
 
-    TFT_sendByte(self, data >> 8);
-    TFT_sendByte(self, data & 0x00ff);
-}
+	if ((cells = TFT_areaSize(cols, rows, 1)) < 0) {
+		PyErr_SetString(PyExc_ValueError, "map must have at least one cell");
+		return -1;
+	}
 
-static
-void TFT_setCol(ILI9341PyObject *self, int StartCol, int EndCol) {
-	TFT_sendCMD(self, 0x2A);	// Column Command address
-	TFT_sendWord(self, StartCol);
-	TFT_sendWord(self, EndCol);
-}
+	// cells are indexed with ints
+	if (cells > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "map has too many cells");
+		return -1;
+	}
 
-static
-void TFT_setPage(ILI9341PyObject *self, int StartPage, int EndPage) {
-	TFT_sendCMD(self, 0x2B);	// Column Command address
-	TFT_sendWord(self, StartPage);
-	TFT_sendWord(self, EndPage);
+	self->tiles = malloc(len);
+	self->map = calloc(cells, sizeof(unsigned short));
+	self->dirty = calloc(cells, 1);
+	if (self->tiles == NULL || self->map == NULL || self->dirty == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	memcpy(self->tiles, tiles, len);
+
+	Py_INCREF(lcd);
+	self->lcd = (ILI9341PyObject *)lcd;
+	self->tile_w = tile_w;
+	self->tile_h = tile_h;
+	self->tile_count = len / tile_size;
+	self->cols = cols;
+	self->rows = rows;
+	self->x = x;
+	self->y = y;
+
+	return 0;
 }
 
-static
-void TFT_setXY(ILI9341PyObject *self, int poX, int poY) {
-	TFT_setCol(self, poX, poX);
-	TFT_setPage(self, poY, poY);
-	TFT_sendCMD(self, 0x2c);
+static void
+tilemap_dealloc(TilemapPyObject *self) {
+	free(self->tiles);
+	free(self->map);
+	free(self->dirty);
+	Py_XDECREF(self->lcd);
+
+	self->ob_type->tp_free((PyObject *)self);
 }
 
-static
-int TFT_rgb2color(ILI9341PyObject *self, int R, int G, int B) {
-	int rgb;
+static PyObject *
+tilemap_set(TilemapPyObject *self, PyObject *args) {
+	int col, row, index;
 
-	/*rgb = R & 0x1F;
-	rgb <<= 6;
-	rgb |= G & 0x3F;
-	rgb <<= 5;
-	rgb |= B & 0x1F;*/
-	
-	rgb = ((R & 0xF8) << 8) | ((G & 0xFC) << 3) | (B >> 3);
+	if (!PyArg_ParseTuple(args, "iii", &col, &row, &index)) {
+		return NULL;
+	}
 
-	return rgb;
-}
+	if (tilemap_setCell(self, col, row, index) < 0) {
+		return NULL;
+	}
 
-static
-void TFT_setPixel(ILI9341PyObject *self, int poX, int poY, int color) {
-	TFT_setXY(self, poX, poY);
-	TFT_sendWord(self, color);
+	tilemap_drawDirty(self);
+
+	Py_RETURN_NONE;
 }
 
-static
-int TFT_char(ILI9341PyObject *self, unsigned char ch) {
-	int bX = self->cursor_x, bY = self->cursor_y, fgcolour = self->color, bgcolour = self->bg_color;
-	int i, j, k;
-	char c = ch;
-	unsigned char *font = self->font;
-	uint8_t width = 0;
-	uint8_t height = font[FONT_HEIGHT];
-	uint8_t bytes = (height + 7) / 8;
-	uint8_t firstChar = font[FONT_FIRST_CHAR];
-	uint8_t charCount = font[FONT_CHAR_COUNT];
-	uint16_t index = 0;
-
-	if (bX >= self->width || bY >= self->height) return -1;
-
-	if (c == ' ') {
-		width = TFT_charWidth(self, ' ');
-		PyObject *pArgs = Py_BuildValue("iiiii", bX, bY, bX + width, bY + height, bgcolour);
-		ili9341_fillRect(self, pArgs);
+static PyObject *
+tilemap_get(TilemapPyObject *self, PyObject *args) {
+	int col, row;
 
-		return width;
+	if (!PyArg_ParseTuple(args, "ii", &col, &row)) {
+		return NULL;
 	}
 
-	if (c < firstChar || c >= (firstChar + charCount)) return 0;
-	c -= firstChar;
-
-	if (font[FONT_LENGTH] == 0 && font[FONT_LENGTH + 1] == 0) {
-		// zero length is flag indicating fixed width font (array does not contain width data entries)
-		width = font[FONT_FIXED_WIDTH];
-		index = c * bytes * width + FONT_WIDTH_TABLE;
-	} else {
-		// variable width font, read width data, to get the index
-		for (i = 0; i < c; i++) {
-			index += font[FONT_WIDTH_TABLE + i];
-		}
-		index = index * bytes + charCount + FONT_WIDTH_TABLE;
-		width = font[FONT_WIDTH_TABLE + c];
+	if (col < 0 || col >= self->cols || row < 0 || row >= self->rows) {
+		PyErr_Format(PyExc_IndexError, "cell %d,%d is out of map", col, row);
+		return NULL;
 	}
 
-	if (bX < -width || bY < -height) return width;
+	return Py_BuildValue("i", self->map[row * self->cols + col]);
+}
 
-	// last but not least, draw the character
-	for (j = 0; j < width; j++) { // Width
-		// for (i = bytes - 1; i < 254; i--) { // Vertical Bytes
-		for (i = 0; i < bytes; i++) { // Vertical Bytes
-			uint8_t data = font[index + j + (i * width)];
-			int offset = (i * 8);
+static PyObject *
+tilemap_update(TilemapPyObject *self, PyObject *args) {
+	PyObject *cells, *seq, *item;
+	int i, n, col, row, index, ret = 0;
 
-			if ((i == bytes - 1) && bytes > 1) {
-				offset = height - 8;
-			} else if (height<8) {
-				offset = height - 7;
-			}
+	if (!PyArg_ParseTuple(args, "O", &cells)) {
+		return NULL;
+	}
 
-			for (k = 0; k < 8; k++) { // Vertical bits
-				if ((offset+k >= i*8) && (offset+k <= height)) {
-					if (data & (1 << k)) {
-						TFT_setPixel(self, bX + j, bY + offset + k, fgcolour);
-					} else {
-						TFT_setPixel(self, bX + j, bY + offset + k, bgcolour);
-					}
-				}
-			}
+	if ((seq = PySequence_Fast(cells, "cells must be a sequence of (col, row, index)")) == NULL) {
+		return NULL;
+	}
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	for (i=0; i<n && ret == 0; i++) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		if (!PyArg_ParseTuple(item, "iii", &col, &row, &index)) {
+			ret = -1;
+		} else {
+			ret = tilemap_setCell(self, col, row, index);
 		}
 	}
+	Py_DECREF(seq);
 
-	return width;
+	// cells set before an error are still drawn
+	tilemap_drawDirty(self);
+
+	if (ret < 0) {
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
 }
 
-static
-int TFT_charWidth(ILI9341PyObject *self, unsigned char ch) {
-    char c = ch;
+static PyObject *
+tilemap_load(TilemapPyObject *self, PyObject *args) {
+	PyObject *indices, *seq;
+	int i, n, index, ret = 0;
 
-    // Space is often not included in font so use width of 'n'
-    if (c == ' ') c = 'n';
-    uint8_t width = 0;
+	if (!PyArg_ParseTuple(args, "O", &indices)) {
+		return NULL;
+	}
+
+	if ((seq = PySequence_Fast(indices, "map must be a sequence of tile indices")) == NULL) {
+		return NULL;
+	}
 
-    uint8_t firstChar = self->font[FONT_FIRST_CHAR];
-    uint8_t charCount = self->font[FONT_FIRST_CHAR];
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n != self->cols * self->rows) {
+		Py_DECREF(seq);
+		PyErr_SetString(PyExc_ValueError, "map must have cols*rows indices");
+		return NULL;
+	}
 
-    uint16_t index = 0;
+	for (i=0; i<n && ret == 0; i++) {
+		index = PyInt_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (index == -1 && PyErr_Occurred()) {
+			ret = -1;
+		} else {
+			ret = tilemap_setCell(self, i % self->cols, i / self->cols, index);
+		}
+	}
+	Py_DECREF(seq);
 
-    if (c < firstChar || c >= (firstChar + charCount)) {
-	    return 0;
-    }
-    c -= firstChar;
+	// as in update, cells set before an error are still drawn
+	tilemap_drawDirty(self);
 
-	if (self->font[FONT_LENGTH] == 0 && self->font[FONT_LENGTH + 1] == 0) {
-	    // zero length is flag indicating fixed width font (array does not contain width data entries)
-	    width = self->font[FONT_FIXED_WIDTH];
-    } else {
-	    // variable width font, read width data
-		width = self->font[FONT_WIDTH_TABLE + c];
-    }
+	if (ret < 0) {
+		return NULL;
+	}
 
-    return width;
+	Py_RETURN_NONE;
 }
 
-static
-void swap(int *a, int *b) {
-	int temp;
+static PyObject *
+tilemap_draw(TilemapPyObject *self, PyObject *unused) {
+	memset(self->dirty, 1, self->cols * self->rows);
+	tilemap_drawDirty(self);
 
-	temp = *b;
-	*b   = *a;
-	*a   = temp;   
+	Py_RETURN_NONE;
 }
 
-
-static PyMethodDef ili9341_methods[] = {
-	{"clear", (PyCFunction)ili9341_clear, METH_NOARGS,
-		"clear()\n\n Clear LCD display."},
-	{"rotation", (PyCFunction)ili9341_rotation, METH_VARARGS,
-		"rotation(mode)\n\n Set rotation mode (0-3)."},
-	{"invert", (PyCFunction)ili9341_invert, METH_VARARGS,
-		"invert(mode)\n\n Invert LCD display."},
-	{"rgb2color", (PyCFunction)ili9341_rgb2color, METH_VARARGS,
-		"rgb2color(r, g, b)\n\n Convert RGB to internal color."},
-	{"pixel", (PyCFunction)ili9341_drawPixel, METH_VARARGS,
-		"pixel(x, y, color)\n\n Draws pixel at specified location and color on LCD display."},
-	{"circle", (PyCFunction)ili9341_drawCircle, METH_VARARGS,
-		"circle(x, y, radius, color)\n\n Draws circle at specified location, radius and color on LCD display."},
-	{"circle_fill", (PyCFunction)ili9341_fillCircle, METH_VARARGS,
-		"circle_fill(x, y, radius, color)\n\n Draws and fills circle at specified location, radius and color on LCD display."},
-	{"line", (PyCFunction)ili9341_drawLine, METH_VARARGS,
-		"line(x0, y0, x1, y1, color)\n\n Draws line at specified locations and color on LCD display."},
-	{"line_vertical", (PyCFunction)ili9341_drawFastVLine, METH_VARARGS,
-		"line_vertical(x, y, len, color)\n\n Draws vertical line at specified location, length and color on LCD display."},
-	{"line_horisontal", (PyCFunction)ili9341_drawFastHLine, METH_VARARGS,
-		"line_horisontal(x, y, len, color)\n\n Draws horisontal line at specified location, length and color on LCD display."},
-	{"triangle", (PyCFunction)ili9341_drawTriangle, METH_VARARGS,
-		"triangle(x0, y0, x1, y1, x2, y2, color)\n\n Draws triangle at specified location and color on LCD display."},
-	{"rect", (PyCFunction)ili9341_drawRect, METH_VARARGS,
-		"rect(x, y, w, h, color)\n\n Draws rect at specified location, width, height and color on LCD display."},
-	{"rect_fill", (PyCFunction)ili9341_fillRect, METH_VARARGS,
-		"rect_fill(x, y, w, h, color)\n\n Draws and fills rect at specified location, width, height and color on LCD display."},
-	{"color", (PyCFunction)ili9341_setColor, METH_VARARGS,
-		"bg_color(c)\n\n Set foreground color."},
-	{"bg_color", (PyCFunction)ili9341_setBgColor, METH_VARARGS,
-		"bg_color(c)\n\n Set background color."},
-	{"cursor", (PyCFunction)ili9341_setCursor, METH_VARARGS,
-		"cursor(x, y)\n\n Set text cursor at specified location."},
-	{"font", (PyCFunction)ili9341_setFont, METH_VARARGS | METH_KEYWORDS,
-		"font(name, spacing=1)\n\n Set text font name and char spacing."},
-	{"char", (PyCFunction)ili9341_drawChar, METH_VARARGS | METH_KEYWORDS,
-		"char(ch, x=0, y=0, color=1)\n\n Draw char at current or specified position with current font and size."},
-	{"write", (PyCFunction)ili9341_writeString, METH_VARARGS | METH_KEYWORDS,
-		"write(string, x=0, y=0, color=1)\n\n Draw string at current or specified position with current font and size."},
-	{"jpeg", (PyCFunction)ili9341_showJpeg, METH_VARARGS | METH_KEYWORDS,
-		"jpeg(filename, x=0, y=0)\n\n Show jpeg file at current or specified position."},
+static PyMethodDef tilemap_methods[] = {
+	{"set", (PyCFunction)tilemap_set, METH_VARARGS,
+		"set(col, row, index)\n\n Change map cell and redraw it if tile differs."},
+	{"get", (PyCFunction)tilemap_get, METH_VARARGS,
+		"get(col, row) -> index\n\n Return tile index of map cell."},
+	{"update", (PyCFunction)tilemap_update, METH_VARARGS,
+		"update(cells)\n\n Change several (col, row, index) cells and redraw changed ones."},
+	{"load", (PyCFunction)tilemap_load, METH_VARARGS,
+		"load(indices)\n\n Replace whole map, cols*rows indices row by row, and redraw changed cells."},
+	{"draw", (PyCFunction)tilemap_draw, METH_NOARGS,
+		"draw()\n\n Redraw whole map."},
 	{NULL}
 };
 
-static PyTypeObject ILI9341ObjectType = {
+static PyTypeObject TilemapObjectType = {
 	PyObject_HEAD_INIT(NULL)
 	0,				/* ob_size        */
-	"ILI9341",		/* tp_name        */
-	sizeof(ILI9341PyObject),		/* tp_basicsize   */
+	"Tilemap",		/* tp_name        */
+	sizeof(TilemapPyObject),		/* tp_basicsize   */
 	0,				/* tp_itemsize    */
-	0,				/* tp_dealloc     */
+	(destructor)tilemap_dealloc,	/* tp_dealloc     */
 	0,				/* tp_print       */
 	0,				/* tp_getattr     */
 	0,				/* tp_setattr     */
@@ -1053,22 +5973,23 @@ static PyTypeObject ILI9341ObjectType = {
 	0,				/* tp_setattro    */
 	0,				/* tp_as_buffer   */
 	Py_TPFLAGS_DEFAULT,		/* tp_flags       */
-	"ILI9341(bus, chip_select, pin_dc, pin_reset) -> LCD\n\nReturn a new ILI9341 object that is connected to the specified bus and pins.\n",	/* tp_doc         */
+	"Tilemap(lcd, tiles, tile_w, tile_h, cols, rows, x=0, y=0) -> tilemap\n\n"
+	"Return a new cols*rows map of tiles, each tile_w*tile_h big-endian RGB565 pixels, placed at x, y.\n",	/* tp_doc         */
 	0,				/* tp_traverse       */
 	0,				/* tp_clear          */
 	0,				/* tp_richcompare    */
 	0,				/* tp_weaklistoffset */
 	0,				/* tp_iter           */
 	0,				/* tp_iternext       */
-	ili9341_methods,	/* tp_methods        */
-	ili9341_members,	/* tp_members        */
+	tilemap_methods,	/* tp_methods        */
+	tilemap_members,	/* tp_members        */
 	0,				/* tp_getset         */
 	0,				/* tp_base           */
 	0,				/* tp_dict           */
 	0,				/* tp_descr_get      */
 	0,				/* tp_descr_set      */
 	0,				/* tp_dictoffset     */
-	(initproc)ili9341_init,		/* tp_init           */
+	(initproc)tilemap_init,		/* tp_init           */
 };
 
 PyMODINIT_FUNC
@@ -1080,6 +6001,18 @@ initili9341(void)
 	if (PyType_Ready(&ILI9341ObjectType) < 0)
 		return;
 
+	SpriteObjectType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&SpriteObjectType) < 0)
+		return;
+
+	SceneObjectType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&SceneObjectType) < 0)
+		return;
+
+	TilemapObjectType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&TilemapObjectType) < 0)
+		return;
+
 	m = Py_InitModule3("ili9341", NULL,
 		   "Python bindings for ILI9341 TFT LCD display via SPI bus");
 	if (m == NULL)
@@ -1087,4 +6020,13 @@ initili9341(void)
 
 	Py_INCREF(&ILI9341ObjectType);
 	PyModule_AddObject(m, "ILI9341", (PyObject *)&ILI9341ObjectType);
+
+	Py_INCREF(&SpriteObjectType);
+	PyModule_AddObject(m, "Sprite", (PyObject *)&SpriteObjectType);
+
+	Py_INCREF(&SceneObjectType);
+	PyModule_AddObject(m, "Scene", (PyObject *)&SceneObjectType);
+
+	Py_INCREF(&TilemapObjectType);
+	PyModule_AddObject(m, "Tilemap", (PyObject *)&TilemapObjectType);
 }
@@ -0,0 +1,432 @@
+/*
+ * pixops.c - bulk pixel operations for ILI9341 module
+ * Copyright (C) 2015, mail@aliaksei.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+#include "pixops.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PX_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PX_NEON
+#endif
+
+/*
+ * Ordered dithering picks level floor((v * max + t) / 255) with the Bayer
+ * threshold t at the middle of each of 16 steps of 0..255 (7..247), so
+ * levels average to v * max / 255 up to integer rounding. Tables hold the
+ * level for every pattern cell and input value, so the inner loop is three
+ * lookups.
+ */
+static const unsigned char pxBayer4[16] = {
+	0,  8,  2, 10,
+	12, 4, 14,  6,
+	3, 11,  1,  9,
+	15, 7, 13,  5
+};
+
+static unsigned char pxOrdered5[16][256], pxOrdered6[16][256];
+static int pxOrderedReady = 0;
+
+static
+void pxOrderedInit(void) {
+	int i, v, t;
+
+	for (i=0; i<16; i++) {
+		t = (2 * pxBayer4[i] + 1) * 255 / 32;
+
+		for (v=0; v<256; v++) {
+			pxOrdered5[i][v] = (v * 31 + t) / 255;
+			pxOrdered6[i][v] = (v * 63 + t) / 255;
+		}
+	}
+
+	pxOrderedReady = 1;
+}
+
+int pxDitherInit(px_dither *d, int mode, int width) {
+	d->mode = mode;
+	d->width = width;
+	d->row = -1;
+	d->err = NULL;
+	pxDitherNextRow(d);
+
+	if (mode == PX_DITHER_ORDERED && !pxOrderedReady) {
+		pxOrderedInit();
+	}
+
+	if (mode == PX_DITHER_FS) {
+		if ((d->err = calloc((width + 2) * 3, sizeof(short))) == NULL) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void pxDitherDone(px_dither *d) {
+	free(d->err);
+	d->err = NULL;
+}
+
+void pxDitherNextRow(px_dither *d) {
+	int i;
+
+	d->row++;
+
+	for (i=0; i<3; i++) {
+		d->carry[i] = 0;
+		d->pending[i] = 0;
+	}
+}
+
+void pxDitherSetRow(px_dither *d, int row) {
+	d->row = row;
+}
+
+static inline
+int pxClamp(int v) {
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/*
+ * Floyd-Steinberg with one row buffer: err[x + 1] holds the error for
+ * column x of current row until it is read, then it collects the next row.
+ * Right neighbour terms wait in carry (this row) and pending (next row).
+ */
+static inline
+int pxDiffuse(px_dither *d, int c, int x, int v, int bits) {
+	short *err = d->err + c;
+	int q, e, e3, e5, e7;
+
+	v = pxClamp(v + err[(x + 1) * 3] + d->carry[c]);
+	q = (v * ((1 << bits) - 1) + 127) / 255;
+	e = v - ((q << (8 - bits)) | (q >> (2 * bits - 8)));
+
+	// rounded shares, last one takes the remainder so no error is lost
+	e3 = (e * 3 + 8) >> 4;
+	e5 = (e * 5 + 8) >> 4;
+	e7 = (e * 7 + 8) >> 4;
+
+	err[x * 3] += e3;
+	err[(x + 1) * 3] = d->pending[c] + e5;
+	d->pending[c] = e - e3 - e5 - e7;
+	d->carry[c] = e7;
+
+	return q;
+}
+
+void pxDitherRow(px_dither *d, unsigned char *dst, const unsigned char *src, int x, int n, int format) {
+	unsigned int c, r, g, b, k, size = pxFormatSize(format), ri = 0, bi = 2;
+
+	if (d->mode == PX_DITHER_NONE) {
+		pxToRGB565(dst, src, n, format);
+		return;
+	}
+
+	if (format == PX_BGR888) {
+		ri = 2;
+		bi = 0;
+	} else if (format == PX_GRAY8) {
+		bi = 0;
+	}
+
+	for (; n > 0; n--, x++, dst += 2, src += size) {
+		r = src[ri];
+		g = src[size == 1 ? 0 : 1];
+		b = src[bi];
+
+		if (d->mode == PX_DITHER_ORDERED) {
+			k = ((d->row & 3) << 2) | (x & 3);
+			c = (pxOrdered5[k][r] << 11) | (pxOrdered6[k][g] << 5) | pxOrdered5[k][b];
+		} else {
+			c = (pxDiffuse(d, 0, x, r, 5) << 11) | (pxDiffuse(d, 1, x, g, 6) << 5) | pxDiffuse(d, 2, x, b, 5);
+		}
+
+		dst[0] = c >> 8;
+		dst[1] = c & 0xff;
+	}
+}
+
+/*
+ * Alpha blending is done on 8-bit channels, x / 255 is computed exactly as
+ * (t + (t >> 8)) >> 8 with t = x + 128, the same way in every kernel.
+ */
+static inline
+unsigned int pxMix(unsigned int s, unsigned int d, unsigned int a) {
+	unsigned int t = s * a + d * (255 - a) + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+static
+void pxBlendRGBA_C(unsigned char *dst, const unsigned char *src, int n) {
+	unsigned int c, r, g, b, a;
+
+	for (; n > 0; n--, dst += 2, src += 4) {
+		a = src[3];
+		if (a == 0) continue;
+
+		c = (dst[0] << 8) | dst[1];
+		r = (c >> 11) & 0x1f;
+		g = (c >> 5) & 0x3f;
+		b = c & 0x1f;
+
+		r = pxMix(src[0], (r << 3) | (r >> 2), a);
+		g = pxMix(src[1], (g << 2) | (g >> 4), a);
+		b = pxMix(src[2], (b << 3) | (b >> 2), a);
+
+		c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+		dst[0] = c >> 8;
+		dst[1] = c & 0xff;
+	}
+}
+
+int pxFormatSize(int format) {
+	switch (format) {
+		case PX_RGBX8888:
+			return 4;
+		case PX_GRAY8:
+			return 1;
+		default:
+			return 3;
+	}
+}
+
+static
+void pxToRGB565_C(unsigned char *dst, const unsigned char *src, int n, int format) {
+	unsigned int c, ri = 0, bi = 2, size = pxFormatSize(format);
+
+	if (format == PX_BGR888) {
+		ri = 2;
+		bi = 0;
+	} else if (format == PX_GRAY8) {
+		bi = 0;
+	}
+
+	for (; n > 0; n--, dst += 2, src += size) {
+		c = ((src[ri] & 0xF8) << 8) | ((src[size == 1 ? 0 : 1] & 0xFC) << 3) | (src[bi] >> 3);
+		dst[0] = c >> 8;
+		dst[1] = c & 0xff;
+	}
+}
+
+#if defined(PX_SSE2)
+
+// 8 pixels as 16-bit channel lanes to big-endian RGB565
+static inline
+__m128i pxPack565_SSE2(__m128i r, __m128i g, __m128i b) {
+	__m128i c = _mm_or_si128(_mm_or_si128(
+		_mm_slli_epi16(_mm_and_si128(r, _mm_set1_epi16(0xF8)), 8),
+		_mm_slli_epi16(_mm_and_si128(g, _mm_set1_epi16(0xFC)), 3)),
+		_mm_srli_epi16(b, 3));
+
+	return _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+}
+
+// 8 pixels from two vectors of 4 byte pixels, R G B at bytes 0 1 2 (2 1 0 for bgr)
+static inline
+__m128i pxPackX_SSE2(__m128i s0, __m128i s1, int bgr) {
+	const __m128i m8 = _mm_set1_epi32(0xff);
+	__m128i lo = _mm_packs_epi32(_mm_and_si128(s0, m8), _mm_and_si128(s1, m8));
+	__m128i hi = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 16), m8), _mm_and_si128(_mm_srli_epi32(s1, 16), m8));
+	__m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 8), m8), _mm_and_si128(_mm_srli_epi32(s1, 8), m8));
+
+	return bgr ? pxPack565_SSE2(hi, g, lo) : pxPack565_SSE2(lo, g, hi);
+}
+
+// spread 4 packed 3 byte pixels from first 12 bytes into 32-bit lanes
+static inline
+__m128i pxSpread3_SSE2(__m128i v) {
+	return _mm_or_si128(_mm_or_si128(
+		_mm_and_si128(v, _mm_setr_epi32(0xffffff, 0, 0, 0)),
+		_mm_and_si128(_mm_slli_si128(v, 1), _mm_setr_epi32(0, 0xffffff, 0, 0))), _mm_or_si128(
+		_mm_and_si128(_mm_slli_si128(v, 2), _mm_setr_epi32(0, 0, 0xffffff, 0)),
+		_mm_and_si128(_mm_slli_si128(v, 3), _mm_setr_epi32(0, 0, 0, 0xffffff))));
+}
+
+void pxToRGB565(unsigned char *dst, const unsigned char *src, int n, int format) {
+	__m128i s0, s1, g;
+
+	switch (format) {
+		case PX_RGB888:
+		case PX_BGR888:
+			// 16 byte loads read 4 bytes past the 8 pixels
+			for (; n >= 10; n -= 8, dst += 16, src += 24) {
+				s0 = pxSpread3_SSE2(_mm_loadu_si128((const __m128i *)src));
+				s1 = pxSpread3_SSE2(_mm_loadu_si128((const __m128i *)(src + 12)));
+				_mm_storeu_si128((__m128i *)dst, pxPackX_SSE2(s0, s1, format == PX_BGR888));
+			}
+			break;
+		case PX_RGBX8888:
+			for (; n >= 8; n -= 8, dst += 16, src += 32) {
+				s0 = _mm_loadu_si128((const __m128i *)src);
+				s1 = _mm_loadu_si128((const __m128i *)(src + 16));
+				_mm_storeu_si128((__m128i *)dst, pxPackX_SSE2(s0, s1, 0));
+			}
+			break;
+		case PX_GRAY8:
+			for (; n >= 8; n -= 8, dst += 16, src += 8) {
+				g = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)src), _mm_setzero_si128());
+				_mm_storeu_si128((__m128i *)dst, pxPack565_SSE2(g, g, g));
+			}
+			break;
+	}
+
+	pxToRGB565_C(dst, src, n, format);
+}
+
+static inline
+__m128i pxMix_SSE2(__m128i s, __m128i d, __m128i a) {
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(s, a),
+		_mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a)));
+
+	t = _mm_add_epi16(t, _mm_set1_epi16(128));
+
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+void pxBlendRGBA(unsigned char *dst, const unsigned char *src, int n) {
+	const __m128i m8 = _mm_set1_epi32(0xff);
+
+	for (; n >= 8; n -= 8, dst += 16, src += 32) {
+		__m128i s0 = _mm_loadu_si128((const __m128i *)src);
+		__m128i s1 = _mm_loadu_si128((const __m128i *)(src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)dst);
+		__m128i sr, sg, sb, sa, r, g, b;
+
+		// RGBA words to one 16-bit lane per pixel and channel
+		sr = _mm_packs_epi32(_mm_and_si128(s0, m8), _mm_and_si128(s1, m8));
+		sg = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 8), m8), _mm_and_si128(_mm_srli_epi32(s1, 8), m8));
+		sb = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 16), m8), _mm_and_si128(_mm_srli_epi32(s1, 16), m8));
+		sa = _mm_packs_epi32(_mm_srli_epi32(s0, 24), _mm_srli_epi32(s1, 24));
+
+		// big-endian RGB565 to 8-bit channels
+		c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+		r = _mm_srli_epi16(c, 11);
+		g = _mm_and_si128(_mm_srli_epi16(c, 5), _mm_set1_epi16(0x3f));
+		b = _mm_and_si128(c, _mm_set1_epi16(0x1f));
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+		r = pxMix_SSE2(sr, r, sa);
+		g = pxMix_SSE2(sg, g, sa);
+		b = pxMix_SSE2(sb, b, sa);
+
+		c = _mm_or_si128(_mm_or_si128(
+			_mm_slli_epi16(_mm_and_si128(r, _mm_set1_epi16(0xF8)), 8),
+			_mm_slli_epi16(_mm_and_si128(g, _mm_set1_epi16(0xFC)), 3)),
+			_mm_srli_epi16(b, 3));
+		c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+
+		_mm_storeu_si128((__m128i *)dst, c);
+	}
+
+	pxBlendRGBA_C(dst, src, n);
+}
+
+#elif defined(PX_NEON)
+
+// 8 pixels of 8-bit channels to big-endian RGB565
+static inline
+uint8x16_t pxPack565_NEON(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+	uint16x8_t c = vshll_n_u8(vand_u8(r, vdup_n_u8(0xF8)), 8);
+
+	c = vorrq_u16(c, vshll_n_u8(vand_u8(g, vdup_n_u8(0xFC)), 3));
+	c = vorrq_u16(c, vmovl_u8(vshr_n_u8(b, 3)));
+
+	return vrev16q_u8(vreinterpretq_u8_u16(c));
+}
+
+void pxToRGB565(unsigned char *dst, const unsigned char *src, int n, int format) {
+	uint8x8x3_t s3;
+	uint8x8x4_t s4;
+	uint8x8_t g;
+
+	switch (format) {
+		case PX_RGB888:
+		case PX_BGR888:
+			for (; n >= 8; n -= 8, dst += 16, src += 24) {
+				s3 = vld3_u8(src);
+				vst1q_u8(dst, format == PX_BGR888 ? pxPack565_NEON(s3.val[2], s3.val[1], s3.val[0])
+					: pxPack565_NEON(s3.val[0], s3.val[1], s3.val[2]));
+			}
+			break;
+		case PX_RGBX8888:
+			for (; n >= 8; n -= 8, dst += 16, src += 32) {
+				s4 = vld4_u8(src);
+				vst1q_u8(dst, pxPack565_NEON(s4.val[0], s4.val[1], s4.val[2]));
+			}
+			break;
+		case PX_GRAY8:
+			for (; n >= 8; n -= 8, dst += 16, src += 8) {
+				g = vld1_u8(src);
+				vst1q_u8(dst, pxPack565_NEON(g, g, g));
+			}
+			break;
+	}
+
+	pxToRGB565_C(dst, src, n, format);
+}
+
+static inline
+uint8x8_t pxMix_NEON(uint8x8_t s, uint8x8_t d, uint8x8_t a) {
+	uint16x8_t t = vmlal_u8(vmull_u8(s, a), d, vmvn_u8(a));
+
+	// (t + 128 + ((t + 128) >> 8)) >> 8
+	return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+void pxBlendRGBA(unsigned char *dst, const unsigned char *src, int n) {
+	for (; n >= 8; n -= 8, dst += 16, src += 32) {
+		uint8x8x4_t s = vld4_u8(src);
+		uint16x8_t c = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(dst)));
+		uint8x8_t r, g, b;
+
+		r = vmovn_u16(vshrq_n_u16(c, 11));
+		g = vmovn_u16(vandq_u16(vshrq_n_u16(c, 5), vdupq_n_u16(0x3f)));
+		b = vmovn_u16(vandq_u16(c, vdupq_n_u16(0x1f)));
+		r = vorr_u8(vshl_n_u8(r, 3), vshr_n_u8(r, 2));
+		g = vorr_u8(vshl_n_u8(g, 2), vshr_n_u8(g, 4));
+		b = vorr_u8(vshl_n_u8(b, 3), vshr_n_u8(b, 2));
+
+		r = pxMix_NEON(s.val[0], r, s.val[3]);
+		g = pxMix_NEON(s.val[1], g, s.val[3]);
+		b = pxMix_NEON(s.val[2], b, s.val[3]);
+
+		c = vshlq_n_u16(vmovl_u8(vand_u8(r, vdup_n_u8(0xF8))), 8);
+		c = vorrq_u16(c, vshlq_n_u16(vmovl_u8(vand_u8(g, vdup_n_u8(0xFC))), 3));
+		c = vorrq_u16(c, vmovl_u8(vshr_n_u8(b, 3)));
+
+		vst1q_u8(dst, vrev16q_u8(vreinterpretq_u8_u16(c)));
+	}
+
+	pxBlendRGBA_C(dst, src, n);
+}
+
+#else
+
+void pxToRGB565(unsigned char *dst, const unsigned char *src, int n, int format) {
+	pxToRGB565_C(dst, src, n, format);
+}
+
+void pxBlendRGBA(unsigned char *dst, const unsigned char *src, int n) {
+	pxBlendRGBA_C(dst, src, n);
+}
+
+#endif
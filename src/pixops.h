@@ -0,0 +1,69 @@
+/*
+ * pixops.h - bulk pixel operations for ILI9341 module
+ * Copyright (C) 2015, mail@aliaksei.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+#ifndef PIXOPS_H
+#define PIXOPS_H
+
+#include <stdlib.h>
+
+/*
+ * All RGB565 buffers are big-endian, the order pixels are sent to the display.
+ * Kernels use SSE2 or NEON when compiler targets them and plain C otherwise.
+ */
+
+// source pixel layouts for pxToRGB565
+#define PX_RGB888	0	/* R, G, B bytes */
+#define PX_BGR888	1	/* B, G, R bytes */
+#define PX_RGBX8888	2	/* R, G, B and ignored byte */
+#define PX_GRAY8	3	/* single luma byte */
+
+// bytes per source pixel of format
+int pxFormatSize(int format);
+
+// convert n pixels of format to RGB565
+void pxToRGB565(unsigned char *dst, const unsigned char *src, int n, int format);
+
+// dithering modes for pxDitherRow
+#define PX_DITHER_NONE		0
+#define PX_DITHER_ORDERED	1	/* 4x4 Bayer */
+#define PX_DITHER_FS		2	/* Floyd-Steinberg */
+
+typedef struct {
+	int mode;
+	int width;
+	int row;
+	int carry[3], pending[3];
+	short *err;		/* next row error terms, (width + 2) * 3 */
+} px_dither;
+
+// set up dithering of rows up to width pixels, returns -1 if out of memory
+int pxDitherInit(px_dither *d, int mode, int width);
+void pxDitherDone(px_dither *d);
+
+// convert n pixels starting at column x of current row, calls for one row
+// must go left to right without gaps
+void pxDitherRow(px_dither *d, unsigned char *dst, const unsigned char *src, int x, int n, int format);
+void pxDitherNextRow(px_dither *d);
+
+// make current row the given one of the image, so the ordered pattern stays
+// anchored when top rows are clipped
+void pxDitherSetRow(px_dither *d, int row);
+
+// composite n RGBA pixels (R, G, B, A bytes) over n RGB565 pixels in place
+void pxBlendRGBA(unsigned char *dst, const unsigned char *src, int n);
+
+#endif // PIXOPS_H
@@ -0,0 +1,188 @@
+#!/usr/bin/env python
+#
+# img565.py - convert images to compressed RGB565 formats of ILI9341 module
+# Copyright (C) 2015, mail@aliaksei.org
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; version 2 of the License.
+#
+# Runs on the build host. Binary PPM/PGM are read directly, other formats
+# (PNG, ...) need PIL or Pillow.
+#
+# Usage: img565.py [-f rle|lz4] [-b block_bytes] input output
+
+import struct
+import sys
+
+
+def read_pnm(f):
+	magic = f.read(2)
+	if magic not in (b'P5', b'P6'):
+		raise ValueError('not a binary PPM/PGM file')
+
+	fields = []
+	while len(fields) < 3:
+		line = f.readline()
+		fields += line.split(b'#')[0].split()
+	w, h, maxval = [int(v) for v in fields]
+	if maxval > 255:
+		raise ValueError('16-bit PPM/PGM is not supported')
+
+	data = bytearray(f.read())
+	pixels = []
+	if magic == b'P6':
+		for i in range(0, w * h * 3, 3):
+			pixels.append(tuple(v * 255 // maxval for v in data[i:i + 3]))
+	else:
+		for v in data[:w * h]:
+			v = v * 255 // maxval
+			pixels.append((v, v, v))
+
+	return w, h, pixels
+
+
+def read_image(name):
+	with open(name, 'rb') as f:
+		if f.read(2) in (b'P5', b'P6'):
+			f.seek(0)
+			return read_pnm(f)
+
+	from PIL import Image
+
+	img = Image.open(name).convert('RGB')
+	return img.size[0], img.size[1], list(img.getdata())
+
+
+def to565(pixels):
+	return [((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3) for r, g, b in pixels]
+
+
+def encode_rle(w, h, pixels, **opts):
+	"""R565 header, then runs (0x80 | n - 1, pixel) and literals (n - 1, pixels)."""
+	out = bytearray(b'R565' + struct.pack('>HH', w, h))
+	i, n = 0, len(pixels)
+
+	while i < n:
+		j = i + 1
+		while j < n and j - i < 128 and pixels[j] == pixels[i]:
+			j += 1
+
+		if j - i >= 2:
+			out += struct.pack('>BH', 0x80 | (j - i - 1), pixels[i])
+			i = j
+			continue
+
+		# literal until next pair of equal pixels
+		j = i + 1
+		while j < n and j - i < 128 and not (j + 1 < n and pixels[j] == pixels[j + 1]):
+			j += 1
+		out.append(j - i - 1)
+		for p in pixels[i:j]:
+			out += struct.pack('>H', p)
+		i = j
+
+	return out
+
+
+def lz4_length(out, n):
+	while n >= 255:
+		out.append(255)
+		n -= 255
+	out.append(n)
+
+
+def lz4_block(data):
+	"""Plain LZ4 block, greedy matching. Uses lz4 package when installed."""
+	try:
+		import lz4.block
+		return bytearray(lz4.block.compress(bytes(data), store_size=False))
+	except ImportError:
+		pass
+
+	out = bytearray()
+	table = {}
+	n = len(data)
+	i = anchor = 0
+
+	# format wants last match to start 12 and end 5 bytes before the end
+	while i < n - 12:
+		key = bytes(data[i:i + 4])
+		ref = table.get(key)
+		table[key] = i
+		if ref is None or i - ref > 65535:
+			i += 1
+			continue
+
+		m = 4
+		while i + m < n - 5 and data[ref + m] == data[i + m]:
+			m += 1
+
+		lit = i - anchor
+		out.append((min(lit, 15) << 4) | min(m - 4, 15))
+		if lit >= 15:
+			lz4_length(out, lit - 15)
+		out += data[anchor:i]
+		out += struct.pack('<H', i - ref)
+		if m - 4 >= 15:
+			lz4_length(out, m - 4 - 15)
+
+		i += m
+		anchor = i
+
+	lit = n - anchor
+	out.append(min(lit, 15) << 4)
+	if lit >= 15:
+		lz4_length(out, lit - 15)
+	out += data[anchor:]
+
+	return out
+
+
+def encode_lz4(w, h, pixels, block=8192):
+	"""L565 header with rows per block, then sized LZ4 blocks of whole rows."""
+	rows = max(1, min(block // (w * 2), 65536 // (w * 2)))
+	out = bytearray(b'L565' + struct.pack('>HHH', w, h, rows))
+
+	for y in range(0, h, rows):
+		raw = bytearray()
+		for p in pixels[y * w:min(y + rows, h) * w]:
+			raw += struct.pack('>H', p)
+		packed = lz4_block(raw)
+		out += struct.pack('>I', len(packed)) + packed
+
+	return out
+
+
+ENCODERS = {
+	'rle': encode_rle,
+	'lz4': encode_lz4,
+}
+
+
+def main(argv):
+	fmt = 'rle'
+	opts = {}
+	while len(argv) > 2 and argv[1] in ('-f', '-b'):
+		if argv[1] == '-f':
+			fmt = argv[2]
+		else:
+			opts['block'] = int(argv[2])
+		argv = argv[:1] + argv[3:]
+
+	if len(argv) != 3 or fmt not in ENCODERS:
+		sys.stderr.write('usage: %s [-f %s] [-b block_bytes] input output\n' % (argv[0], '|'.join(sorted(ENCODERS))))
+		return 1
+
+	w, h, pixels = read_image(argv[1])
+	data = ENCODERS[fmt](w, h, to565(pixels), **opts)
+
+	with open(argv[2], 'wb') as f:
+		f.write(data)
+
+	sys.stderr.write('%s: %dx%d, %d bytes (%d raw)\n' % (argv[2], w, h, len(data), w * h * 2))
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
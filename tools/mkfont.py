@@ -0,0 +1,291 @@
+#!/usr/bin/env python
+#
+# mkfont.py - convert fonts to binary font files of ILI9341 module
+# Copyright (C) 2015, mail@aliaksei.org
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; version 2 of the License.
+#
+# Runs on the build host. Reads FontCreator arrays as in src/fonts/*.h, BDF
+# and PCF fonts (also gzipped) and writes FNT1 files for load_font().
+# Glyphs are converted to the column layout the module draws from, with
+# code points kept as in the source font, so BDF/PCF fonts should be
+# ISO10646 encoded. Ranges like 0x20-0x7e,0x400-0x44f pick a subset, for
+# example of a CJK font.
+#
+# Usage: mkfont.py [-r ranges] input output.fnt
+
+import gzip
+import re
+import struct
+import sys
+
+
+ESCAPES = {'n': '\n', 't': '\t', '0': '\0'}
+
+
+def number(v):
+	"""Integer or char literal of C array, first char is often given as '+'."""
+	if v[0] != "'":
+		return int(v, 0)
+	if v[1] == '\\':
+		return ord(ESCAPES.get(v[2], v[2]))
+	return ord(v[1])
+
+
+def read_fontcreator(name):
+	"""Glyphs of FontCreator array: length, fixed width, height, first, count, widths, columns."""
+	with open(name) as f:
+		src = f.read()
+
+	src = re.sub(r'/\*.*?\*/|//[^\n]*', '', src, flags=re.S)
+	body = src[src.index('{') + 1:src.rindex('}')]
+	data = [number(v) for v in re.findall(r"0[xX][0-9a-fA-F]+|\d+|'\\?.'", body)]
+
+	height, first, count = data[3], data[4], data[5]
+	fixed = data[0] == 0 and data[1] == 0
+	pos = 6 if fixed else 6 + count
+	nbytes = (height + 7) // 8
+
+	glyphs = {}
+	for i in range(count):
+		w = data[2] if fixed else data[6 + i]
+		glyphs[first + i] = (w, bytearray(data[pos:pos + w * nbytes]))
+		pos += w * nbytes
+
+	return height, glyphs
+
+
+def encode_glyph(width, height, pixel):
+	"""Columns as bytes LSB at top, last byte aligned to glyph bottom (see TFT_glyphRow)."""
+	nbytes = (height + 7) // 8
+	out = bytearray(width * nbytes)
+
+	for i in range(nbytes):
+		for bit in range(8):
+			if height < 8:
+				r = bit + height - 7
+			elif nbytes > 1 and i == nbytes - 1:
+				r = bit + height - 8
+			else:
+				r = i * 8 + bit
+			if r < 0 or r >= height:
+				continue
+			for j in range(width):
+				if pixel(r, j):
+					out[j + i * width] |= 1 << bit
+
+	return out
+
+
+def place_glyph(glyphs, code, advance, ascent, height, bbx, bits):
+	"""Glyph cell is advance (or ink if wider) by font height, bits[row] has ink pixel columns."""
+	w, h, xoff, yoff = bbx
+	width = min(max(advance, xoff + w, 0), 255)
+	top = ascent - (yoff + h)
+
+	def pixel(r, c):
+		r, c = r - top, c - xoff
+		return 0 <= r < h and 0 <= c < w and c in bits[r]
+
+	glyphs[code] = (width, encode_glyph(width, height, pixel))
+
+
+def read_bdf(f):
+	"""Glyphs of BDF font, cells span FONT_ASCENT + FONT_DESCENT rows."""
+	props = {}
+	chars = []
+	lines = iter(f.read().decode('latin-1').splitlines())
+
+	for line in lines:
+		v = line.split()
+		if not v:
+			continue
+		if v[0] in ('FONTBOUNDINGBOX', 'FONT_ASCENT', 'FONT_DESCENT'):
+			props[v[0]] = [int(n) for n in v[1:]]
+		elif v[0] == 'STARTCHAR':
+			code, advance, bbx, bits = -1, 0, None, []
+			for line in lines:
+				v = line.split()
+				if v[0] == 'ENCODING':
+					code = int(v[1])
+				elif v[0] == 'DWIDTH':
+					advance = int(v[1])
+				elif v[0] == 'BBX':
+					bbx = [int(n) for n in v[1:5]]
+				elif v[0] == 'BITMAP':
+					for row in lines:
+						if row.strip() == 'ENDCHAR':
+							break
+						n = int(row, 16)
+						nbits = len(row.strip()) * 4
+						bits.append(set(c for c in range(nbits) if n >> (nbits - 1 - c) & 1))
+					break
+			if code >= 0 and bbx is not None:
+				chars.append((code, advance, bbx, bits))
+
+	fbb = props.get('FONTBOUNDINGBOX', [0, 0, 0, 0])
+	ascent = props.get('FONT_ASCENT', [fbb[1] + fbb[3]])[0]
+	descent = props.get('FONT_DESCENT', [-fbb[3]])[0]
+	height = ascent + descent
+
+	glyphs = {}
+	for code, advance, bbx, bits in chars:
+		place_glyph(glyphs, code, advance, ascent, height, bbx, bits)
+
+	return height, glyphs
+
+
+PCF_ACCELERATORS = 1 << 1
+PCF_METRICS = 1 << 2
+PCF_BITMAPS = 1 << 3
+PCF_BDF_ENCODINGS = 1 << 5
+PCF_BDF_ACCELERATORS = 1 << 8
+
+
+def read_pcf(f):
+	"""Glyphs of PCF font, tables as written by bdftopcf."""
+	data = f.read()
+	count = struct.unpack('<I', data[4:8])[0]
+	toc = {}
+	for i in range(count):
+		kind, fmt, size, offset = struct.unpack('<IIII', data[8 + i * 16:24 + i * 16])
+		toc[kind] = offset
+
+	def table(kind):
+		offset = toc[kind]
+		fmt = struct.unpack('<I', data[offset:offset + 4])[0]
+		order = '>' if fmt & 4 else '<'
+		return fmt, order, offset + 4
+
+	# font ascent and descent
+	fmt, order, pos = table(PCF_BDF_ACCELERATORS if PCF_BDF_ACCELERATORS in toc else PCF_ACCELERATORS)
+	ascent, descent = struct.unpack(order + 'ii', data[pos + 8:pos + 16])
+	height = ascent + descent
+
+	# per glyph bearings, advance, ascent and descent
+	fmt, order, pos = table(PCF_METRICS)
+	metrics = []
+	if fmt & 0x100:
+		n = struct.unpack(order + 'H', data[pos:pos + 2])[0]
+		for i in range(n):
+			metrics.append([b - 0x80 for b in bytearray(data[pos + 2 + i * 5:pos + 7 + i * 5])])
+	else:
+		n = struct.unpack(order + 'I', data[pos:pos + 4])[0]
+		for i in range(n):
+			metrics.append(struct.unpack(order + 'hhhhh', data[pos + 4 + i * 12:pos + 14 + i * 12]))
+
+	# bitmaps, rows padded to 1 << (fmt & 3) bytes, bits in scan units of 1 << (fmt >> 4 & 3)
+	fmt, order, pos = table(PCF_BITMAPS)
+	n = struct.unpack(order + 'I', data[pos:pos + 4])[0]
+	offsets = struct.unpack(order + '%dI' % n, data[pos + 4:pos + 4 + n * 4])
+	bitmaps = pos + 4 + n * 4 + 16
+	pad, unit, msb = 1 << (fmt & 3), 1 << (fmt >> 4 & 3), fmt & 8
+	swap = unit > 1 and bool(fmt & 4) != bool(fmt & 8)
+
+	def bits_of(i):
+		lsb, rsb, advance, asc, desc = metrics[i][:5]
+		stride = ((rsb - lsb + 7) // 8 + pad - 1) // pad * pad
+		rows = []
+		for r in range(asc + desc):
+			row = bytearray(data[bitmaps + offsets[i] + r * stride:bitmaps + offsets[i] + (r + 1) * stride])
+			if swap:
+				row = bytearray(b for k in range(0, stride, unit) for b in reversed(row[k:k + unit]))
+			rows.append(set(c for c in range(rsb - lsb) if row[c // 8] >> (7 - c % 8 if msb else c % 8) & 1))
+		return advance, [rsb - lsb, asc + desc, lsb, -desc], rows
+
+	# code points, byte1 selects row of byte2 table
+	fmt, order, pos = table(PCF_BDF_ENCODINGS)
+	min2, max2, min1, max1 = struct.unpack(order + 'hhhh', data[pos:pos + 8])
+	cols = max2 - min2 + 1
+	n = cols * (max1 - min1 + 1)
+	index = struct.unpack(order + '%dH' % n, data[pos + 10:pos + 10 + n * 2])
+
+	glyphs = {}
+	for k, i in enumerate(index):
+		if i != 0xffff:
+			advance, bbx, rows = bits_of(i)
+			place_glyph(glyphs, ((min1 + k // cols) << 8) | (min2 + k % cols), advance, ascent, height, bbx, rows)
+
+	return height, glyphs
+
+
+def read_font(name):
+	with open(name, 'rb') as f:
+		gz = f.read(2) == b'\x1f\x8b'
+
+	with (gzip.open if gz else open)(name, 'rb') as f:
+		magic = f.read(9)
+		f.seek(0)
+		if magic[:4] == b'\x01fcp':
+			return read_pcf(f)
+		if magic == b'STARTFONT':
+			return read_bdf(f)
+
+	return read_fontcreator(name)
+
+
+def parse_ranges(arg):
+	ranges = []
+	for part in arg.split(','):
+		lo, _, hi = part.partition('-')
+		ranges.append((int(lo, 0), int(hi or lo, 0)))
+	return ranges
+
+
+def encode_font(height, glyphs):
+	"""FNT1 file: header, ranges of consecutive code points, offsets, widths, columns."""
+	codes = sorted(glyphs)
+	ranges = []
+	for i, c in enumerate(codes):
+		if ranges and ranges[-1][0] + ranges[-1][1] == c:
+			ranges[-1][1] += 1
+		else:
+			ranges.append([c, 1, i])
+
+	out = bytearray(b'FNT1' + struct.pack('<HHI', height, len(ranges), len(codes)))
+	for r in ranges:
+		out += struct.pack('<III', *r)
+
+	pos = len(out) + len(codes) * 5
+	for c in codes:
+		out += struct.pack('<I', pos)
+		pos += len(glyphs[c][1])
+	for c in codes:
+		out.append(glyphs[c][0])
+	for c in codes:
+		out += glyphs[c][1]
+
+	return out
+
+
+def main(argv):
+	ranges = None
+	if len(argv) > 2 and argv[1] == '-r':
+		ranges = parse_ranges(argv[2])
+		argv = argv[:1] + argv[3:]
+
+	if len(argv) != 3:
+		sys.stderr.write('usage: %s [-r first-last,...] input output.fnt\n' % argv[0])
+		return 1
+
+	height, glyphs = read_font(argv[1])
+	if ranges is not None:
+		glyphs = dict((c, g) for c, g in glyphs.items() if any(lo <= c <= hi for lo, hi in ranges))
+
+	if not 0 < height < 256 or not glyphs:
+		sys.stderr.write('%s: no glyphs or height %d out of range\n' % (argv[1], height))
+		return 1
+
+	data = encode_font(height, glyphs)
+
+	with open(argv[2], 'wb') as f:
+		f.write(data)
+
+	sys.stderr.write('%s: height %d, %d glyphs, %d bytes\n' % (argv[2], height, len(glyphs), len(data)))
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))